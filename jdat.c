@@ -3,6 +3,123 @@
 #include <lz4/lz4hc.h>
 #include <lz4/lz4_all.c>
 
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#define JDAT_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <io.h>
+typedef HANDLE PacketThread;
+#define JDAT_THREAD_PROC(name) static DWORD WINAPI name(LPVOID param)
+#define JDAT_THREAD_RETURN return 0
+#else
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <errno.h>
+#include <stddef.h>
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <linux/memfd.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+typedef pthread_t PacketThread;
+#define JDAT_THREAD_PROC(name) static void* name(void* param)
+#define JDAT_THREAD_RETURN return NULL
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define JDAT_TARGET(x)
+#else
+#define JDAT_TARGET(x) __attribute__((target(x)))
+#endif
+
+#if defined(_WIN32)
+static b32 PacketThreadStart(PacketThread* thread, LPTHREAD_START_ROUTINE proc, void* param) {
+    *thread = CreateThread(NULL, 0, proc, param, 0, NULL);
+    return (*thread != NULL);
+}
+
+static void PacketThreadJoin(PacketThread thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+static u32 PacketAtomicIncrement(volatile u32* value) {
+    return (u32)InterlockedIncrement((volatile LONG*)value);
+}
+
+static void* PacketAtomicLoadPtr(void* volatile* ptr) {
+    return InterlockedCompareExchangePointer(ptr, NULL, NULL);
+}
+
+static void PacketAtomicStorePtr(void* volatile* ptr, void* value) {
+    InterlockedExchangePointer(ptr, value);
+}
+
+static u64 PacketAtomicLoad64(volatile u64* value) {
+    return (u64)InterlockedCompareExchange64((volatile LONG64*)value, 0, 0);
+}
+
+// Swaps in desired if *value is *expected; otherwise loads *value into *expected.
+static b32 PacketAtomicCompareExchange64(volatile u64* value, u64* expected, u64 desired) {
+    u64 seen = (u64)InterlockedCompareExchange64((volatile LONG64*)value, (LONG64)desired, (LONG64)*expected);
+    b32 swapped = (seen == *expected);
+    *expected = seen;
+    return swapped;
+}
+#else
+static b32 PacketThreadStart(PacketThread* thread, void* (*proc)(void*), void* param) {
+    return (pthread_create(thread, NULL, proc, param) == 0);
+}
+
+static void PacketThreadJoin(PacketThread thread) {
+    pthread_join(thread, NULL);
+}
+
+static u32 PacketAtomicIncrement(volatile u32* value) {
+    return __atomic_add_fetch(value, 1, __ATOMIC_RELAXED);
+}
+
+static void* PacketAtomicLoadPtr(void* volatile* ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+}
+
+static void PacketAtomicStorePtr(void* volatile* ptr, void* value) {
+    __atomic_store_n(ptr, value, __ATOMIC_RELAXED);
+}
+
+static u64 PacketAtomicLoad64(volatile u64* value) {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+// Swaps in desired if *value is *expected; otherwise loads *value into *expected.
+static b32 PacketAtomicCompareExchange64(volatile u64* value, u64* expected, u64 desired) {
+    return __atomic_compare_exchange_n(value, expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+#endif
+
+#if defined(_MSC_VER)
+#define JDAT_THREAD_LOCAL __declspec(thread)
+#else
+#define JDAT_THREAD_LOCAL _Thread_local
+#endif
+
 jd_StringCompressed StringCompress(jd_Arena* arena, jd_String src) {
     jd_StringCompressed compressed_string = {0};
     if (src.count == 0) return compressed_string;
@@ -60,6 +177,16 @@ const jd_String element_windowdressing = {
     .count = sizeof(" = ;\n") - 1
 };
 
+// NOTE(JD): The only places jdat reaches into a jd_Arena. Rewinding to a mark frees everything allocated
+// after it was taken.
+static u64 PacketArenaMark(jd_Arena* arena) {
+    return arena->pos;
+}
+
+static void PacketArenaRewind(jd_Arena* arena, u64 mark) {
+    jd_ArenaPopTo(arena, mark);
+}
+
 jdat_Packet* PacketCreate(jd_Arena* arena) {
     jdat_Packet* packet = jd_ArenaAlloc(arena, sizeof(*packet));
     packet->head = NULL;
@@ -69,7 +196,196 @@ jdat_Packet* PacketCreate(jd_Arena* arena) {
     return packet;
 }
 
-PacketHeader* PacketHeaderPushBack(jdat_Packet* packet, jd_String tag) {
+jd_ForceInline b32 PacketIsWhitespace(u8 c) {
+    return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+}
+
+static jd_String PacketStringTrim(jd_String str) {
+    while (str.count > 0 && PacketIsWhitespace(str.mem[0])) {
+        str.mem++;
+        str.count--;
+    }
+    
+    while (str.count > 0 && PacketIsWhitespace(str.mem[str.count - 1])) {
+        str.count--;
+    }
+    
+    return str;
+}
+
+static b32 PacketStringHasWhitespace(jd_String str) {
+    for (u64 i = 0; i < str.count; i++) {
+        if (PacketIsWhitespace(str.mem[i])) return true;
+    }
+    
+    return false;
+}
+
+// NOTE(JD): Tags and keys lose all their whitespace when pushed. With a symbol table the table keeps the
+// only copy, so the string is only copied here when it has whitespace inside it.
+static jd_String PacketStringStripForSymbol(jd_Arena* arena, jd_String str) {
+    str = PacketStringTrim(str);
+    if (PacketStringHasWhitespace(str)) str = jd_StringPushIgnoreChars(arena, str, jd_StrLit(" \t\n\r"));
+    return str;
+}
+
+// NOTE(JD): FNV-1a. Keys are short, so this beats anything fancier.
+u32 PacketKeyHash(jd_String key) {
+    u32 hash = 2166136261u;
+    for (u64 i = 0; i < key.count; i++) {
+        hash ^= key.mem[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// NOTE(JD): From here on the packet's tags and keys are interned in table, including those of headers and
+// elements already in the packet. Headers still waiting on PacketHeaderMaterialize intern their keys when
+// they are decoded. A table can be shared by any number of packets, but only from one thread at a time.
+void PacketSetSymbolTable(jdat_Packet* packet, jdat_SymbolTable* table) {
+    packet->symbols = table;
+    for (PacketHeader* header = packet->head; header != NULL; header = header->next) {
+        header->symbols = table;
+        header->tag_id = PacketSymbolIntern(table, header->tag);
+        header->tag = table->symbols[header->tag_id].str;
+        if (header->lazy) continue;
+        
+        for (u64 i = 0; i < header->num_elements; i++) {
+            PacketElement* element = &header->elements[i];
+            element->key_id = PacketSymbolIntern(table, element->key);
+            element->key = table->symbols[element->key_id].str;
+        }
+    }
+}
+
+jdat_SymbolTable* PacketSymbolTableCreate(jd_Arena* arena) {
+    jdat_SymbolTable* table = jd_ArenaAlloc(arena, sizeof(*table));
+    table->arena = arena;
+    table->count = 1; // id 0 is no symbol
+    return table;
+}
+
+static u32 PacketSymbolLookup(jdat_SymbolTable* table, jd_String str, u32 hash) {
+    if (table->slots == NULL) return 0;
+    
+    u64 mask = table->slot_capacity - 1;
+    u64 slot = hash & mask;
+    while (table->slots[slot].id != 0) {
+        PacketSymbolSlot* s = &table->slots[slot];
+        if (s->hash == hash && jd_StringMatch(table->symbols[s->id].str, str)) return s->id;
+        slot = (slot + 1) & mask;
+    }
+    
+    return 0;
+}
+
+static void PacketSymbolSlotInsert(jdat_SymbolTable* table, u32 id, u32 hash) {
+    u64 mask = table->slot_capacity - 1;
+    u64 slot = hash & mask;
+    while (table->slots[slot].id != 0) slot = (slot + 1) & mask;
+    table->slots[slot].hash = hash;
+    table->slots[slot].id = id;
+}
+
+u32 PacketSymbolFind(jdat_SymbolTable* table, jd_String str) {
+    return PacketSymbolLookup(table, str, PacketKeyHash(str));
+}
+
+// NOTE(JD): The string is copied into the table's arena the first time it is seen. Slots are kept at
+// most half full, like the tag and key indices.
+u32 PacketSymbolIntern(jdat_SymbolTable* table, jd_String str) {
+    u32 hash = PacketKeyHash(str);
+    u32 id = PacketSymbolLookup(table, str, hash);
+    if (id != 0) return id;
+    
+    if (table->count >= table->symbol_capacity) {
+        u64 capacity = jd_Max(table->symbol_capacity * 2, 64);
+        PacketSymbol* symbols = jd_ArenaAlloc(table->arena, sizeof(PacketSymbol) * capacity);
+        if (table->symbols != NULL) jd_MemCpy(symbols, table->symbols, sizeof(PacketSymbol) * table->count);
+        table->symbols = symbols;
+        table->symbol_capacity = capacity;
+    }
+    
+    if (table->count * 2 > table->slot_capacity) {
+        table->slot_capacity = jd_Max(table->slot_capacity * 2, 128);
+        table->slots = jd_ArenaAlloc(table->arena, sizeof(PacketSymbolSlot) * table->slot_capacity);
+        for (u32 i = 1; i < table->count; i++) {
+            PacketSymbolSlotInsert(table, i, table->symbols[i].hash);
+        }
+    }
+    
+    id = (u32)table->count++;
+    table->symbols[id].str = jd_StringPush(table->arena, str);
+    table->symbols[id].hash = hash;
+    PacketSymbolSlotInsert(table, id, hash);
+    return id;
+}
+
+jd_String PacketSymbolString(jdat_SymbolTable* table, u32 id) {
+    jd_String str = {0};
+    if (id != 0 && id < table->count) str = table->symbols[id].str;
+    return str;
+}
+
+static PacketTagSlot* PacketTagIndexFind(jdat_Packet* packet, jd_String tag, u32 hash) {
+    if (packet->tag_index == NULL) return NULL;
+    
+    u64 mask = packet->tag_index_capacity - 1;
+    u64 slot = hash & mask;
+    while (packet->tag_index[slot].tag.mem != NULL) {
+        PacketTagSlot* s = &packet->tag_index[slot];
+        if (s->hash == hash && jd_StringMatch(s->tag, tag)) return s;
+        slot = (slot + 1) & mask;
+    }
+    
+    return NULL;
+}
+
+static PacketTagSlot* PacketTagIndexInsert(jdat_Packet* packet, jd_String tag, u32 hash) {
+    if (packet->tag_index == NULL || (packet->tag_count + 1) * 2 > packet->tag_index_capacity) {
+        PacketTagSlot* old_index = packet->tag_index;
+        u64 old_capacity = packet->tag_index_capacity;
+        
+        packet->tag_index_capacity = (old_capacity > 0) ? old_capacity * 2 : 16;
+        packet->tag_index = jd_ArenaAlloc(packet->arena, sizeof(PacketTagSlot) * packet->tag_index_capacity);
+        u64 mask = packet->tag_index_capacity - 1;
+        for (u64 i = 0; i < old_capacity; i++) {
+            if (old_index[i].tag.mem == NULL) continue;
+            u64 slot = old_index[i].hash & mask;
+            while (packet->tag_index[slot].tag.mem != NULL) slot = (slot + 1) & mask;
+            packet->tag_index[slot] = old_index[i];
+        }
+    }
+    
+    u64 mask = packet->tag_index_capacity - 1;
+    u64 slot = hash & mask;
+    while (packet->tag_index[slot].tag.mem != NULL) {
+        slot = (slot + 1) & mask;
+    }
+    
+    PacketTagSlot* s = &packet->tag_index[slot];
+    s->tag = tag;
+    s->hash = hash;
+    packet->tag_count++;
+    return s;
+}
+
+// NOTE(JD): Every header is threaded onto a per-tag chain (next_with_tag/last_with_tag) in packet order, and
+// the packet's tag index maps each tag to the first and last header of its chain.
+static void PacketTagIndexAppend(jdat_Packet* packet, PacketHeader* header) {
+    u32 hash = (header->tag_id != 0) ? header->symbols->symbols[header->tag_id].hash : PacketKeyHash(header->tag);
+    PacketTagSlot* s = PacketTagIndexFind(packet, header->tag, hash);
+    if (s == NULL) s = PacketTagIndexInsert(packet, header->tag, hash);
+    
+    header->next_with_tag = NULL;
+    header->last_with_tag = s->last;
+    if (s->last) s->last->next_with_tag = header;
+    else s->first = header;
+    s->last = header;
+    header->tag_indexed = true;
+}
+
+static PacketHeader* PacketHeaderLink(jdat_Packet* packet, jd_String tag) {
     PacketHeader* header = NULL;
     PacketHeader* last = NULL;
     if (packet->head == NULL) {
@@ -82,18 +398,38 @@ PacketHeader* PacketHeaderPushBack(jdat_Packet* packet, jd_String tag) {
         header = packet->tail->next;
     }
     
-    header->tag = jd_StringPushIgnoreChars(packet->arena, tag, jd_StrLit("\t\r\n "));
+    header->tag = tag;
     header->num_elements = 0;
+    header->element_capacity = PACKET_HEADER_INLINE_ELEMENTS;
+    header->elements = header->inline_elements;
     header->text_size = tag.count + header_windowdressing.count;
     header->next = NULL;
     header->arena = packet->arena;
     header->last = last;
+    header->cache_text = packet->cache_text;
+    
+    if (packet->symbols != NULL) {
+        header->symbols = packet->symbols;
+        header->tag_id = PacketSymbolIntern(packet->symbols, tag);
+        header->tag = packet->symbols->symbols[header->tag_id].str;
+    }
     
     packet->tail = header;
+    PacketTagIndexAppend(packet, header);
     
     return header;
 }
 
+PacketHeader* PacketHeaderPushBack(jdat_Packet* packet, jd_String tag) {
+    if (packet->symbols != NULL) return PacketHeaderLink(packet, PacketStringStripForSymbol(packet->arena, tag));
+    return PacketHeaderLink(packet, jd_StringPushIgnoreChars(packet->arena, tag, jd_StrLit("\t\r\n ")));
+}
+
+// NOTE(JD): The tag is not copied, only trimmed. It has to outlive the packet.
+PacketHeader* PacketHeaderPushBackBorrowed(jdat_Packet* packet, jd_String tag) {
+    return PacketHeaderLink(packet, PacketStringTrim(tag));
+}
+
 void PacketHeaderPop(jdat_Packet* packet, PacketHeader* header) {
     if (header == packet->tail) {
         packet->tail = header->last;
@@ -110,18 +446,139 @@ void PacketHeaderPop(jdat_Packet* packet, PacketHeader* header) {
     if (header->next) {
         header->next->last = header->last;
     }
+    
+    if (header->tag_indexed) {
+        PacketTagSlot* s = PacketTagIndexFind(packet, header->tag, PacketKeyHash(header->tag));
+        if (s != NULL) {
+            if (s->first == header) s->first = header->next_with_tag;
+            if (s->last == header)  s->last = header->last_with_tag;
+        }
+        
+        if (header->last_with_tag) header->last_with_tag->next_with_tag = header->next_with_tag;
+        if (header->next_with_tag) header->next_with_tag->last_with_tag = header->last_with_tag;
+        header->next_with_tag = NULL;
+        header->last_with_tag = NULL;
+        header->tag_indexed = false;
+    }
 }
 
-PacketElement* PacketElementPushBack(PacketHeader* header, PacketElement* in_element) {
-    jd_Assert(header->num_elements < PACKET_HEADER_MAX_ELEMENTS);
-    if (in_element->value_type == PACKET_ELEMENT_VALUE_TYPE_NULL || in_element->value_type == PACKET_ELEMENT_VALUE_TYPE_COUNT) return NULL;
-    header->elements[header->num_elements] = jd_ArenaAlloc(header->arena, sizeof(PacketElement));
-    PacketElement* element = header->elements[header->num_elements];
+static void PacketHeaderKeyIndexInsert(PacketHeader* header, u64 element_index) {
+    PacketElement* element = &header->elements[element_index];
+    u32 hash = (element->key_id != 0) ? header->symbols->symbols[element->key_id].hash : PacketKeyHash(element->key);
+    u64 mask = header->key_index_capacity - 1;
+    u64 slot = hash & mask;
+    while (header->key_index[slot].element != 0) {
+        slot = (slot + 1) & mask;
+    }
+    
+    header->key_index[slot].hash = hash;
+    header->key_index[slot].element = (u32)(element_index + 1);
+}
+
+// NOTE(JD): Open addressing with linear probing, kept at most half full. Keys are inserted in element
+// order, so with duplicate keys a lookup still finds the first one, same as the linear scan.
+void PacketHeaderBuildKeyIndex(PacketHeader* header) {
+    if (header->num_elements > PACKET_HEADER_KEY_INDEX_MAX_ELEMENTS) return;
+    
+    u64 capacity = 16;
+    while (capacity < header->num_elements * 2) capacity *= 2;
+    
+    header->key_index = jd_ArenaAlloc(header->arena, sizeof(PacketKeySlot) * capacity);
+    header->key_index_capacity = capacity;
+    for (u64 i = 0; i < header->num_elements; i++) {
+        PacketHeaderKeyIndexInsert(header, i);
+    }
+}
+
+// NOTE(JD): The index is built as soon as a header reaches PACKET_HEADER_KEY_INDEX_MIN_ELEMENTS, so lookups
+// never write to the header and can run on several threads at once.
+static void PacketHeaderKeyIndexPushed(PacketHeader* header) {
+    if (header->num_elements > PACKET_HEADER_KEY_INDEX_MAX_ELEMENTS) {
+        header->key_index = NULL;
+        header->key_index_capacity = 0;
+        return;
+    }
+    
+    if (header->key_index == NULL) {
+        if (header->num_elements >= PACKET_HEADER_KEY_INDEX_MIN_ELEMENTS) PacketHeaderBuildKeyIndex(header);
+        return;
+    }
+    
+    if (header->num_elements * 2 > header->key_index_capacity) PacketHeaderBuildKeyIndex(header);
+    else PacketHeaderKeyIndexInsert(header, header->num_elements - 1);
+}
+
+// NOTE(JD): Any change to a header's elements has to come through here so a cached copy of its text is
+// never written out stale.
+void PacketHeaderInvalidateText(PacketHeader* header) {
+    header->cached_text.mem = NULL;
+    header->cached_text.count = 0;
+}
+
+static u64 PacketElementValueTextSize(PacketElementValueType type, PacketElementData* data) {
+    u64 size = packet_type_strlens[type] + packet_type_sizes[type];
+    if (type == PACKET_ELEMENT_VALUE_TYPE_STRING) size += data->str.count;
+    return size;
+}
+
+// NOTE(JD): Changes an element of header in place, keeping text_size right and dropping the header's cached
+// text. Like PacketElementPushBackByArg, a string value is stored as given, not copied.
+PacketElement* PacketElementSetByArg(PacketHeader* header, PacketElement* element, PacketElementValueType type, PacketElementData data) {
+    if (type == PACKET_ELEMENT_VALUE_TYPE_NULL || type == PACKET_ELEMENT_VALUE_TYPE_COUNT) return NULL;
+    jd_Assert(element >= header->elements && element < header->elements + header->num_elements);
+    
+    header->text_size -= PacketElementValueTextSize(element->value_type, &element->data);
+    element->value_type = type;
+    element->data = data;
+    header->text_size += PacketElementValueTextSize(element->value_type, &element->data);
+    
+    PacketHeaderInvalidateText(header);
+    return element;
+}
+
+// NOTE(JD): Headers of this packet (existing, and those pushed later) keep a copy of their text after they are first
+// serialized, and later serializations copy that instead of encoding the elements again. Edits made by
+// writing through a PacketElement* directly must be followed by PacketHeaderInvalidateText.
+void PacketEnableTextCache(jdat_Packet* packet) {
+    packet->cache_text = true;
+    for (PacketHeader* header = packet->head; header != NULL; header = header->next) {
+        header->cache_text = true;
+    }
+}
+
+static void PacketHeaderCacheText(PacketHeader* header, u8* text, u64 count) {
+    if (!header->cache_text || header->cached_text.mem != NULL) return;
+    jd_String written = { .mem = text, .count = count };
+    header->cached_text = jd_StringPush(header->arena, written);
+}
+
+static void PacketHeaderReserveElements(PacketHeader* header, u64 count) {
+    if (count <= header->element_capacity) return;
+    
+    u64 capacity = jd_Max(count, header->element_capacity * 2);
+    PacketElement* elements = jd_ArenaAlloc(header->arena, sizeof(PacketElement) * capacity);
+    jd_MemCpy(elements, header->elements, sizeof(PacketElement) * header->num_elements);
+    
+    header->elements = elements;
+    header->element_capacity = capacity;
+}
+
+static PacketElement* PacketElementLink(PacketHeader* header, PacketElement* in_element, jd_String key) {
+    PacketHeaderMaterialize(header);
+    PacketHeaderInvalidateText(header);
+    PacketHeaderReserveElements(header, header->num_elements + 1);
+    PacketElement* element = &header->elements[header->num_elements];
     header->num_elements++;
-    element->key = jd_StringPushIgnoreChars(header->arena, in_element->key, jd_StrLit(" \t\n\r"));
+    element->key = key;
+    element->key_id = 0;
     element->value_type = in_element->value_type;
     element->data = in_element->data;
     
+    if (header->symbols != NULL) {
+        element->key_id = PacketSymbolIntern(header->symbols, key);
+        element->key = header->symbols->symbols[element->key_id].str;
+    }
+    
     header->text_size += element->key.count;
     header->text_size += element_windowdressing.count;
     header->text_size += packet_type_strlens[element->value_type];
@@ -131,23 +588,28 @@ PacketElement* PacketElementPushBack(PacketHeader* header, PacketElement* in_ele
         header->text_size += in_element->data.str.count;
     }
     
+    PacketHeaderKeyIndexPushed(header);
     return element;
 }
 
+PacketElement* PacketElementPushBack(PacketHeader* header, PacketElement* in_element) {
+    if (in_element->value_type == PACKET_ELEMENT_VALUE_TYPE_NULL || in_element->value_type == PACKET_ELEMENT_VALUE_TYPE_COUNT) return NULL;
+    if (header->symbols != NULL) return PacketElementLink(header, in_element, PacketStringStripForSymbol(header->arena, in_element->key));
+    return PacketElementLink(header, in_element, jd_StringPushIgnoreChars(header->arena, in_element->key, jd_StrLit(" \t\n\r")));
+}
+
+// NOTE(JD): Like PacketElementPushBack, but the key (and string value) are views, not copies.
+PacketElement* PacketElementPushBackBorrowed(PacketHeader* header, PacketElement* in_element) {
+    if (in_element->value_type == PACKET_ELEMENT_VALUE_TYPE_NULL || in_element->value_type == PACKET_ELEMENT_VALUE_TYPE_COUNT) return NULL;
+    return PacketElementLink(header, in_element, PacketStringTrim(in_element->key));
+}
+
+// NOTE(JD): The slot lives in header->elements, so text_size and the key index are updated here for what
+// in_element holds now. Changing the value through the returned pointer later goes through
+// PacketElementSetByArg; the key must not change once pushed.
 PacketElement* PacketElementPushBackInPlace(PacketHeader* header, PacketElement* in_element) {
-    if (header->num_elements >= PACKET_HEADER_MAX_ELEMENTS) return NULL;
     if (in_element->value_type == PACKET_ELEMENT_VALUE_TYPE_NULL || in_element->value_type == PACKET_ELEMENT_VALUE_TYPE_COUNT) return NULL;
-    PacketElement* element = header->elements[header->num_elements] = in_element;
-    header->num_elements++;
-    header->text_size += element->key.count;
-    header->text_size += element_windowdressing.count;
-    header->text_size += packet_type_strlens[element->value_type];
-    header->text_size += packet_type_sizes[element->value_type];
-    
-    if (element->value_type == PACKET_ELEMENT_VALUE_TYPE_STRING) {
-        header->text_size += in_element->data.str.count;
-    }
-    return element;
+    return PacketElementLink(header, in_element, in_element->key);
 }
 
 PacketElement* PacketElementPushBackByArg(PacketHeader* header, jd_String key, PacketElementValueType type, PacketElementData data) {
@@ -262,10 +724,23 @@ PacketElement* PacketElementPushBackString(PacketHeader* header, jd_String key,
     return out;
 }
 
+// NOTE(JD): Headers whose tag was interned in symbols compare ids; tag_id is tag's id there, looked up
+// once by the caller. Headers from elsewhere (joined or copied in) fall back to comparing strings.
+static b32 PacketHeaderTagMatch(PacketHeader* header, jd_String tag, jdat_SymbolTable* symbols, u32 tag_id) {
+    if (header->tag_id != 0 && header->symbols == symbols) return header->tag_id == tag_id;
+    return jd_StringMatch(header->tag, tag);
+}
+
 PacketHeader* PacketGetFirstHeaderWithTag(jdat_Packet* packet, jd_String tag) {
+    if (packet->tag_index != NULL) {
+        PacketTagSlot* s = PacketTagIndexFind(packet, tag, PacketKeyHash(tag));
+        return (s != NULL) ? s->first : NULL;
+    }
+    
+    u32 tag_id = (packet->symbols != NULL) ? PacketSymbolFind(packet->symbols, tag) : 0;
     PacketHeader* header = packet->head;
     while (header != NULL) {
-        if (jd_StringMatch(header->tag, tag)) {
+        if (PacketHeaderTagMatch(header, tag, packet->symbols, tag_id)) {
             return header;
         }
         
@@ -276,9 +751,15 @@ PacketHeader* PacketGetFirstHeaderWithTag(jdat_Packet* packet, jd_String tag) {
 }
 
 PacketHeader* PacketGetNextHeaderWithTag(PacketHeader* starting_header, jd_String tag) {
+    jdat_SymbolTable* symbols = starting_header->symbols;
+    u32 tag_id = (symbols != NULL) ? PacketSymbolFind(symbols, tag) : 0;
+    if (starting_header->tag_indexed && PacketHeaderTagMatch(starting_header, tag, symbols, tag_id)) {
+        return starting_header->next_with_tag;
+    }
+    
     PacketHeader* header = starting_header->next;
     while (header != NULL) {
-        if (jd_StringMatch(header->tag, tag)) {
+        if (PacketHeaderTagMatch(header, tag, symbols, tag_id)) {
             return header;
         }
         
@@ -288,151 +769,411 @@ PacketHeader* PacketGetNextHeaderWithTag(PacketHeader* starting_header, jd_Strin
     return header;
 }
 
-PacketElement* PacketGetElementWithKey(PacketHeader* header, jd_String key) {
-    for (u32 i = 0; i < header->num_elements; i++) {
-        if (jd_StringMatch(header->elements[i]->key, key)) {
-            return header->elements[i];
+static PacketElement* PacketHeaderScanForKey(PacketHeader* header, jd_String key) {
+    for (u64 i = 0; i < header->num_elements; i++) {
+        if (jd_StringMatch(header->elements[i].key, key)) {
+            return &header->elements[i];
         }
     }
     
     return NULL;
 }
 
+// NOTE(JD): Use this with a hash from PacketKeyHash when looking up the same keys over and over.
+PacketElement* PacketGetElementWithKeyHash(PacketHeader* header, jd_String key, u32 hash) {
+    PacketHeaderMaterialize(header);
+    if (header->key_index == NULL) {
+        return PacketHeaderScanForKey(header, key);
+    }
+    
+    u64 mask = header->key_index_capacity - 1;
+    u64 slot = hash & mask;
+    while (header->key_index[slot].element != 0) {
+        PacketKeySlot* s = &header->key_index[slot];
+        if (s->hash == hash) {
+            PacketElement* element = &header->elements[s->element - 1];
+            if (jd_StringMatch(element->key, key)) return element;
+        }
+        
+        slot = (slot + 1) & mask;
+    }
+    
+    return NULL;
+}
 
-PacketElementValueType ParseElementValueType(jd_String value_type_str) {
-    if (jd_StrContainsSubstrLit(value_type_str, "u64")) {
-        return PACKET_ELEMENT_VALUE_TYPE_U64;
+// NOTE(JD): For a header with a symbol table. Every comparison is between ids; a header past
+// PACKET_HEADER_KEY_INDEX_MIN_ELEMENTS probes its key index with the hash the table already holds.
+PacketElement* PacketGetElementWithKeyId(PacketHeader* header, u32 key_id) {
+    PacketHeaderMaterialize(header);
+    if (key_id == 0 || header->symbols == NULL) return NULL;
+    
+    if (header->key_index == NULL) {
+        for (u64 i = 0; i < header->num_elements; i++) {
+            if (header->elements[i].key_id == key_id) return &header->elements[i];
+        }
+        
+        return NULL;
     }
     
-    else if (jd_StrContainsSubstrLit(value_type_str, "u32")) {
-        return PACKET_ELEMENT_VALUE_TYPE_U32;
+    u32 hash = header->symbols->symbols[key_id].hash;
+    u64 mask = header->key_index_capacity - 1;
+    u64 slot = hash & mask;
+    while (header->key_index[slot].element != 0) {
+        PacketKeySlot* s = &header->key_index[slot];
+        if (s->hash == hash && header->elements[s->element - 1].key_id == key_id) return &header->elements[s->element - 1];
+        slot = (slot + 1) & mask;
     }
-    else if (jd_StrContainsSubstrLit(value_type_str, "i64")) {
-        return PACKET_ELEMENT_VALUE_TYPE_S64;
+    
+    return NULL;
+}
+
+PacketElement* PacketGetElementWithKey(PacketHeader* header, jd_String key) {
+    PacketHeaderMaterialize(header);
+    if (header->symbols != NULL) {
+        return PacketGetElementWithKeyId(header, PacketSymbolFind(header->symbols, key));
     }
     
-    else if (jd_StrContainsSubstrLit(value_type_str, "i32")) {
-        return PACKET_ELEMENT_VALUE_TYPE_S32;
+    if (header->num_elements < PACKET_HEADER_KEY_INDEX_MIN_ELEMENTS) {
+        return PacketHeaderScanForKey(header, key);
     }
     
-    else if (jd_StrContainsSubstrLit(value_type_str, "f64")) {
-        return PACKET_ELEMENT_VALUE_TYPE_F64;
+    return PacketGetElementWithKeyHash(header, key, PacketKeyHash(key));
+}
+
+
+// NOTE(JD): The type token is whatever sits between '=' and ':', so it is trimmed and then decoded by length
+// and first byte. Every token is matched in constant time; anything else decodes to NULL, which the parser
+// reports as PACKET_UNKNOWN_TYPE.
+PacketElementValueType ParseElementValueType(jd_String value_type_str) {
+    jd_String token = PacketStringTrim(value_type_str);
+    
+    switch (token.count) {
+        case 2: {
+            if (token.mem[0] == 'c' && token.mem[1] == '8') return PACKET_ELEMENT_VALUE_TYPE_C8;
+            break;
+        }
+        
+        case 3: {
+            b32 is_64 = (token.mem[1] == '6' && token.mem[2] == '4');
+            b32 is_32 = (token.mem[1] == '3' && token.mem[2] == '2');
+            if (!is_64 && !is_32) break;
+            
+            switch (token.mem[0]) {
+                case 'u': return is_64 ? PACKET_ELEMENT_VALUE_TYPE_U64 : PACKET_ELEMENT_VALUE_TYPE_U32;
+                case 'i': return is_64 ? PACKET_ELEMENT_VALUE_TYPE_S64 : PACKET_ELEMENT_VALUE_TYPE_S32;
+                case 'f': return is_64 ? PACKET_ELEMENT_VALUE_TYPE_F64 : PACKET_ELEMENT_VALUE_TYPE_F32;
+                case 'b': return is_32 ? PACKET_ELEMENT_VALUE_TYPE_B32 : PACKET_ELEMENT_VALUE_TYPE_NULL;
+            }
+            
+            break;
+        }
+        
+        case 6: {
+            if (jd_StringMatch(token, jd_StrLit("string"))) return PACKET_ELEMENT_VALUE_TYPE_STRING;
+            break;
+        }
     }
     
-    else if (jd_StrContainsSubstrLit(value_type_str, "f32")) {
-        return PACKET_ELEMENT_VALUE_TYPE_F32;
+    return PACKET_ELEMENT_VALUE_TYPE_NULL;
+}
+
+// NOTE(JD): Structural scanner. The parser asks for the next structural character ('@', '{', '=', ':', ';', '}')
+// at or after an index. Positions are found 64 bytes at a time as a bitmask, and only for the blocks the parser
+// actually lands in, so binary payloads the parser skips by length are never scanned.
+#define PACKET_SCAN_BLOCK_SIZE 64
+
+typedef u64 (*PacketScanBlockFunc)(u8* mem);
+
+typedef struct PacketScanner {
+    PacketScanBlockFunc scan_block;
+    u8* mem;
+    u64 count;
+    u64 block_start;
+    u64 block_mask;
+    b32 has_block;
+} PacketScanner;
+
+jd_ForceInline b32 PacketIsStructural(u8 c) {
+    return (c == '@' || c == '{' || c == '=' || c == ':' || c == ';' || c == '}');
+}
+
+jd_ForceInline u64 PacketCountTrailingZeros(u64 mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index = 0;
+    _BitScanForward64(&index, mask);
+    return index;
+#else
+    return (u64)__builtin_ctzll(mask);
+#endif
+}
+
+static u64 PacketScanBlockScalar(u8* mem) {
+    u64 mask = 0;
+    for (u64 i = 0; i < PACKET_SCAN_BLOCK_SIZE; i++) {
+        if (PacketIsStructural(mem[i])) mask |= (1ull << i);
+    }
+    return mask;
+}
+
+#if defined(JDAT_X86)
+JDAT_TARGET("sse4.2")
+static u64 PacketScanBlockSSE42(u8* mem) {
+    const __m128i set = _mm_setr_epi8('@', '{', '=', ':', ';', '}', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    u64 mask = 0;
+    for (u64 i = 0; i < PACKET_SCAN_BLOCK_SIZE; i += 16) {
+        __m128i chunk = _mm_loadu_si128((__m128i*)&mem[i]);
+        __m128i hits = _mm_cmpestrm(set, 6, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK);
+        mask |= ((u64)(u32)_mm_cvtsi128_si32(hits) & 0xFFFF) << i;
+    }
+    return mask;
+}
+
+JDAT_TARGET("avx2")
+static u64 PacketScanBlockAVX2(u8* mem) {
+    u64 mask = 0;
+    for (u64 i = 0; i < PACKET_SCAN_BLOCK_SIZE; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((__m256i*)&mem[i]);
+        __m256i hits = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('@'));
+        hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('{')));
+        hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('=')));
+        hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(':')));
+        hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(';')));
+        hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('}')));
+        mask |= ((u64)(u32)_mm256_movemask_epi8(hits)) << i;
     }
+    return mask;
+}
+
+static void PacketCPUID(u32 leaf, u32 subleaf, u32 regs[4]) {
+#if defined(_MSC_VER)
+    __cpuidex((int*)regs, (int)leaf, (int)subleaf);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+JDAT_TARGET("xsave")
+static u64 PacketXGETBV(void) {
+    return _xgetbv(0);
+}
+#endif
+
+static PacketScanBlockFunc PacketScanBlockSelect(void) {
+#if defined(JDAT_X86)
+    u32 regs[4] = {0};
+    PacketCPUID(0, 0, regs);
+    u32 max_leaf = regs[0];
+    
+    PacketCPUID(1, 0, regs);
+    b32 has_sse42   = (regs[2] & (1u << 20)) != 0;
+    b32 has_osxsave = (regs[2] & (1u << 27)) != 0;
     
-    else if (jd_StrContainsSubstrLit(value_type_str, "b32")) {
-        return PACKET_ELEMENT_VALUE_TYPE_B32;
+    if (max_leaf >= 7 && has_osxsave && (PacketXGETBV() & 0x6) == 0x6) {
+        PacketCPUID(7, 0, regs);
+        if (regs[1] & (1u << 5)) return PacketScanBlockAVX2;
     }
     
-    else if (jd_StrContainsSubstrLit(value_type_str, "c8")) {
-        return PACKET_ELEMENT_VALUE_TYPE_C8;
+    if (has_sse42) return PacketScanBlockSSE42;
+#endif
+    return PacketScanBlockScalar;
+}
+
+// NOTE(JD): Parsers on several threads can race to select the block scanner. Every thread selects the
+// same function, so relaxed loads and stores are enough to make the race benign.
+static void* volatile packet_scan_block = NULL;
+
+static PacketScanner PacketScannerCreate(jd_String str) {
+    PacketScanBlockFunc scan_block = (PacketScanBlockFunc)PacketAtomicLoadPtr(&packet_scan_block);
+    if (scan_block == NULL) {
+        scan_block = PacketScanBlockSelect();
+        PacketAtomicStorePtr(&packet_scan_block, (void*)scan_block);
     }
     
-    else if (jd_StrContainsSubstrLit(value_type_str, "string")) {
-        return PACKET_ELEMENT_VALUE_TYPE_STRING;
+    PacketScanner scanner = {
+        .scan_block = scan_block,
+        .mem = str.mem,
+        .count = str.count
+    };
+    return scanner;
+}
+
+// Returns the index of the next structural character at or after index, or scanner->count if there are none.
+static u64 PacketScannerFind(PacketScanner* scanner, u64 index) {
+    while (index < scanner->count) {
+        u64 block_start = index - (index % PACKET_SCAN_BLOCK_SIZE);
+        if (!scanner->has_block || scanner->block_start != block_start) {
+            if (block_start + PACKET_SCAN_BLOCK_SIZE <= scanner->count) {
+                scanner->block_mask = scanner->scan_block(&scanner->mem[block_start]);
+            }
+            else {
+                scanner->block_mask = 0;
+                for (u64 i = block_start; i < scanner->count; i++) {
+                    if (PacketIsStructural(scanner->mem[i])) scanner->block_mask |= (1ull << (i - block_start));
+                }
+            }
+            
+            scanner->block_start = block_start;
+            scanner->has_block = true;
+        }
+        
+        u64 mask = scanner->block_mask & (~0ull << (index - block_start));
+        if (mask) return block_start + PacketCountTrailingZeros(mask);
+        index = block_start + PACKET_SCAN_BLOCK_SIZE;
     }
     
-    else return PACKET_ELEMENT_VALUE_TYPE_NULL;
+    return scanner->count;
 }
 
-void PacketSetError(jdat_Packet* packet, PacketErrorCode code, c8 missing_char, u32 error_index) {
+void PacketSetError(jdat_Packet* packet, PacketErrorCode code, c8 missing_char, u64 error_index) {
     packet->error.success = false;
     packet->error.code = code;
     packet->error.missing_char = missing_char;
     packet->error.error_index = error_index;
 }
 
-jdat_Packet* PacketParse(jd_Arena* arena, jd_String packet_string) {
-    jdat_Packet* packet = PacketCreate(arena);
-    packet->error.success = true;
-    PacketHeader* packet_header = NULL;
-    u32 index = 0;
-    u32 str_in_progress_index = 0;
+static PacketTagFilter* PacketFindTagFilter(PacketParseState* state, jd_String tag) {
+    for (u64 i = 0; i < state->tag_filter_count; i++) {
+        if (jd_StringMatch(state->tag_filters[i].tag, tag)) return &state->tag_filters[i];
+    }
     
-    jd_String key = {
-        .mem = NULL,
-        .count = 0
-    };
+    return NULL;
+}
+
+static b32 PacketTagFilterHasKey(PacketTagFilter* filter, jd_String key) {
+    for (u64 i = 0; i < filter->key_count; i++) {
+        if (jd_StringMatch(filter->keys[i], key)) return true;
+    }
     
-    jd_String value = {
-        .mem = NULL,
-        .count = 0
-    };
+    return false;
+}
+
+// NOTE(JD): Runs the parse state machine over packet_string, starting from wherever state left off.
+// If final is false, running out of input is not an error: the state is left pointing at the token
+// in progress so the caller can append more bytes and run again.
+// With state->skim set, the grammar is walked (payloads are still skipped by length) but nothing is
+// allocated or pushed, headers and elements are counted, and the run stops on the '@' of the first header
+// at or after state->stop_index.
+static b32 PacketParseRun(jdat_Packet* packet, PacketParseState* state, jd_String packet_string, b32 borrow, b32 final) {
+    jd_Arena* arena = packet->arena;
+    PacketScanner scanner = PacketScannerCreate(packet_string);
+    
+    u64 index = state->index;
+    c8 required_char = state->required_char;
     
     jd_String value_type_str = {
         .mem = NULL,
         .count = 0
     };
     
-    c8 required_char = '@';
-    for (; index < packet_string.count;) {
-        while (index < packet_string.count && packet_string.mem[index] != required_char) {
+    while (true) {
+        while (true) {
+            index = PacketScannerFind(&scanner, index);
+            if (index >= packet_string.count || packet_string.mem[index] == required_char) break;
             if (required_char == '=' && packet_string.mem[index] == '}') {
                 required_char = '@';
+                if (state->header != NULL && state->header->lazy) {
+                    state->header->lazy_source.count = (u64)(&packet_string.mem[index + 1] - state->header->lazy_source.mem);
+                }
+                
+                if (state->visitor != NULL && state->visiting_header) {
+                    state->visiting_header = false;
+                    if (state->visitor->on_header_end) state->visitor->on_header_end(state->visitor->user);
+                }
+                
+                state->header = NULL;
             }
             index++;
         }
         
-        if (index == packet_string.count && required_char != '@') {
-            if (required_char == '{' || 
-                required_char == '}') {
-                PacketSetError(packet, PACKET_INCOMPLETE_HEADER, required_char, index); break;
+        if (index >= packet_string.count) {
+            if (final && required_char != '@') {
+                if (required_char == '{' || 
+                    required_char == '}') {
+                    PacketSetError(packet, PACKET_INCOMPLETE_HEADER, required_char, state->base_offset + index);
+                }
+                
+                if (required_char == '=' || 
+                    required_char == ':' ||
+                    required_char == ';') {
+                    PacketSetError(packet, PACKET_INCOMPLETE_ELEMENT, required_char, state->base_offset + index);
+                }
             }
             
-            if (required_char == '=' || 
-                required_char == ':' ||
-                required_char == ';') {
-                PacketSetError(packet, PACKET_INCOMPLETE_ELEMENT, required_char, index); break;
-            }
+            break;
         }
         
-        
         if (required_char == '@') {
-            str_in_progress_index = index + 1;
+            if (state->skim && index >= state->stop_index) break;
+            state->str_in_progress_index = index + 1;
             required_char = '{';
         }
         
         else if (required_char == '{') {
-            u64 tag_count = index - str_in_progress_index;
-            if (tag_count == 0) { PacketSetError(packet, PACKET_INCOMPLETE_HEADER, required_char, index); break; } 
+            u64 tag_count = index - state->str_in_progress_index;
+            if (tag_count == 0) { PacketSetError(packet, PACKET_INCOMPLETE_HEADER, required_char, state->base_offset + index); break; } 
             jd_String tag = {
-                .mem = &packet_string.mem[str_in_progress_index],
+                .mem = &packet_string.mem[state->str_in_progress_index],
                 .count = tag_count
             };
             
-            str_in_progress_index = index + 1;
-            packet_header = PacketHeaderPushBack(packet, tag);
+            state->str_in_progress_index = index + 1;
+            if (state->skim) state->header_count++;
+            state->tag_filter = NULL;
+            if (state->tag_filter_count > 0) {
+                state->tag_filter = PacketFindTagFilter(state, PacketStringTrim(tag));
+            }
+            
+            if (state->visitor != NULL && state->tag_filter_count == 0) {
+                state->visiting_header = true;
+                if (state->visitor->on_header_begin) state->visitor->on_header_begin(state->visitor->user, PacketStringTrim(tag));
+            }
+            
+            if (state->skim || state->visitor != NULL || (state->tag_filter_count > 0 && state->tag_filter == NULL)) state->header = NULL;
+            else state->header = (borrow || state->lazy) ? PacketHeaderPushBackBorrowed(packet, tag) : PacketHeaderPushBack(packet, tag);
+            
+            if (state->header != NULL && state->lazy) {
+                state->header->lazy = true;
+                state->header->lazy_source.mem = &packet_string.mem[index + 1];
+            }
+            
             required_char = '=';
         }
         
         else if (required_char == '=') {
-            u64 tag_count = index - str_in_progress_index;
-            if (tag_count == 0) { PacketSetError(packet, PACKET_INCOMPLETE_ELEMENT, required_char, index); break; }
+            u64 tag_count = index - state->str_in_progress_index;
+            if (tag_count == 0) { PacketSetError(packet, PACKET_INCOMPLETE_ELEMENT, required_char, state->base_offset + index); break; }
             
-            key.mem = &packet_string.mem[str_in_progress_index];
-            key.count = tag_count;
+            state->key_index = state->str_in_progress_index;
+            state->key_count = tag_count;
             
-            str_in_progress_index = index + 1;
+            state->str_in_progress_index = index + 1;
             required_char = ':';
         }
         
         else if (required_char == ':') {
-            u64 tag_count = index - str_in_progress_index;
-            if (tag_count == 0) { PacketSetError(packet, PACKET_INCOMPLETE_ELEMENT, required_char, index); break; }
-            value_type_str.mem = &packet_string.mem[str_in_progress_index];
+            u64 tag_count = index - state->str_in_progress_index;
+            if (tag_count == 0) { PacketSetError(packet, PACKET_INCOMPLETE_ELEMENT, required_char, state->base_offset + index); break; }
+            value_type_str.mem = &packet_string.mem[state->str_in_progress_index];
             value_type_str.count = tag_count;
             
             PacketElementValueType type = ParseElementValueType(value_type_str);
+            if (state->skim) state->element_count++;
             PacketElement element = {0};
-            element.key = key;
+            element.key.mem = &packet_string.mem[state->key_index];
+            element.key.count = state->key_count;
             element.value_type = type;
             
+            b32 keep = (state->header != NULL && !state->header->lazy);
+            if (keep && state->tag_filter != NULL && state->tag_filter->key_count > 0) {
+                keep = PacketTagFilterHasKey(state->tag_filter, PacketStringTrim(element.key));
+            }
+            
             u32 size = packet_type_sizes[type];
-            u32 data_index = index + 1;
-            if (data_index + size > packet_string.count) { PacketSetError(packet, PACKET_INCOMPLETE_ELEMENT, required_char, index); break; }
+            u64 data_index = index + 1;
+            if (data_index + size > packet_string.count) { 
+                if (final) PacketSetError(packet, PACKET_INCOMPLETE_ELEMENT, required_char, state->base_offset + index); 
+                break; 
+            }
             
             if (type == PACKET_ELEMENT_VALUE_TYPE_U64) {
                 jd_Assert(size == sizeof(u64));
@@ -484,240 +1225,2198 @@ jdat_Packet* PacketParse(jd_Arena* arena, jd_String packet_string) {
             
             else if (type == PACKET_ELEMENT_VALUE_TYPE_STRING) {
                 jd_Assert(size == sizeof(u64));
-                if (data_index + size > packet_string.count) { PacketSetError(packet, PACKET_INCOMPLETE_ELEMENT, required_char, index); break; }
                 u64  str_index = data_index + sizeof(u64);
                 u64* str_len_ptr = (u64*)&packet_string.mem[data_index];
                 
                 u64 count = *str_len_ptr;
-                if (count + str_index > packet_string.count) { PacketSetError(packet, PACKET_INCOMPLETE_ELEMENT, required_char, index); break; }
+                if (count > packet_string.count - str_index) { 
+                    if (final) PacketSetError(packet, PACKET_INCOMPLETE_ELEMENT, required_char, state->base_offset + index); 
+                    break; 
+                }
+                
                 jd_String data_str = {
                     .count = count,
                     .mem = &packet_string.mem[str_index]
                 };
                 
-                element.data.str = jd_StringPush(arena, data_str);
+                element.data.str = (borrow || !keep) ? data_str : jd_StringPush(arena, data_str);
                 index += count;
             }
             
             else {
-                PacketSetError(packet, PACKET_UNKNOWN_TYPE, required_char, index); 
+                PacketSetError(packet, PACKET_UNKNOWN_TYPE, required_char, state->base_offset + index); 
                 break;
             }
             
             index += size;
             
-            PacketElementPushBack(packet_header, &element);
+            if (keep) {
+                if (borrow) PacketElementPushBackBorrowed(state->header, &element);
+                else PacketElementPushBack(state->header, &element);
+            }
+            
+            else if (state->visiting_header && state->visitor->on_element) {
+                element.key = PacketStringTrim(element.key);
+                state->visitor->on_element(state->visitor->user, &element);
+            }
+            
             required_char = ';';
         }
         
         else if (required_char == ';') {
-            str_in_progress_index = index + 1;
+            state->str_in_progress_index = index + 1;
             required_char = '=';
         }
-        
     }
     
-    return packet;
+    state->index = index;
+    state->required_char = required_char;
+    return packet->error.success;
 }
 
-jd_String PacketToString(jd_Arena* arena, jdat_Packet* packet, jd_ArenaStr* arena_str) {
-    jd_String element_type_strings[PACKET_ELEMENT_VALUE_TYPE_COUNT] = {
-        jd_StrLit("NULL"),
-        jd_StrLit("u64:"),
-        jd_StrLit("u32:"),
-        jd_StrLit("i64:"),
-        jd_StrLit("i32:"),
-        jd_StrLit("f64:"),
-        jd_StrLit("f32:"),
-        jd_StrLit("b32:"),
-        jd_StrLit("c8:"),
-        jd_StrLit("string:")
-    };
-    
-    b32 use_passed_arenastr = true;
-    jd_ArenaStr* packet_str = NULL;
-    if (arena_str == NULL) {
-        packet_str = jd_ArenaStrCreate(0, MEGABYTES(16));
-        use_passed_arenastr = false;
+static const u8 packet_binary_magic[4] = { 0x89, 'J', 'D', 'B' };
+
+b32 PacketIsBinary(jd_String packet_string) {
+    if (packet_string.count < PACKET_BINARY_PREFIX_SIZE) return false;
+    for (u32 i = 0; i < sizeof(packet_binary_magic); i++) {
+        if (packet_string.mem[i] != packet_binary_magic[i]) return false;
     }
-    else {
-        packet_str = arena_str;
+    
+    return true;
+}
+
+static b32 PacketReadVarint(jd_String in, u64* index, u64* out) {
+    u64 value = 0;
+    for (u32 shift = 0; shift < 64; shift += 7) {
+        if (*index >= in.count) return false;
+        u8 byte = in.mem[(*index)++];
+        value |= (u64)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *out = value;
+            return true;
+        }
     }
     
-    jd_String o_bracket_s = jd_StrLit(" {\n");
-    jd_String equals_s = jd_StrLit(" = ");
-    jd_String semic_s = jd_StrLit(";\n");
-    jd_String c_bracket_s = jd_StrLit("}\n");
+    return false;
+}
+
+// NOTE(JD): Binary counterpart of PacketParseRun. Every length is known before the bytes it covers, so
+// there is nothing to scan for: values are bounds checked and copied (or borrowed) directly. Tag filters
+// and key projection apply as they do to text. PACKET_PARSE_LAZY has no effect; headers are decoded eagerly.
+// With state->skim set, the input is only checked and counted.
+static b32 PacketParseBinary(jdat_Packet* packet, PacketParseState* state, jd_String in, b32 borrow) {
+    if (in.mem[PACKET_BINARY_PREFIX_SIZE - 1] != PACKET_BINARY_VERSION) {
+        PacketSetError(packet, PACKET_UNSUPPORTED_VERSION, 0, PACKET_BINARY_PREFIX_SIZE - 1);
+        return false;
+    }
     
-    PacketHeader* header = packet->head;
-    while (header != NULL) {
-        if (header->num_elements == 0) header = header->next;
-        b32 at_w = jd_ArenaStrAppendC8(packet_str, '@');
-        b32 tag_w = jd_ArenaStrAppendStr(packet_str, header->tag);
-        b32 o_brac_w = jd_ArenaStrAppendStr(packet_str, o_bracket_s);
-        
-        for (u32 i = 0; i < header->num_elements; i++) {
-            b32 key_w = jd_ArenaStrAppendStr(packet_str, header->elements[i]->key);
-            b32 equal_w = jd_ArenaStrAppendStr(packet_str, equals_s);
-            b32 type_s_w = jd_ArenaStrAppendStr(packet_str, element_type_strings[header->elements[i]->value_type]);
-            switch (header->elements[i]->value_type) {
-                case PACKET_ELEMENT_VALUE_TYPE_U64:
-                case PACKET_ELEMENT_VALUE_TYPE_U32:
-                case PACKET_ELEMENT_VALUE_TYPE_S64:
-                case PACKET_ELEMENT_VALUE_TYPE_S32:
-                case PACKET_ELEMENT_VALUE_TYPE_F64:
-                case PACKET_ELEMENT_VALUE_TYPE_F32:
-                case PACKET_ELEMENT_VALUE_TYPE_B32:
-                case PACKET_ELEMENT_VALUE_TYPE_C8:
-                b32 data = jd_ArenaStrAppendBin(packet_str, &header->elements[i]->data, packet_type_sizes[header->elements[i]->value_type]);
-                break;
+    u64 index = PACKET_BINARY_PREFIX_SIZE;
+    while (index < in.count) {
+        u64 header_start = index;
+        u64 tag_count = 0;
+        u64 element_count = 0;
+        if (!PacketReadVarint(in, &index, &tag_count) || tag_count > in.count - index) {
+            PacketSetError(packet, PACKET_INCOMPLETE_HEADER, 0, header_start);
+            return false;
+        }
+        
+        jd_String tag = { .mem = &in.mem[index], .count = tag_count };
+        index += tag_count;
+        
+        if (!PacketReadVarint(in, &index, &element_count)) {
+            PacketSetError(packet, PACKET_INCOMPLETE_HEADER, 0, header_start);
+            return false;
+        }
+        
+        PacketTagFilter* filter = NULL;
+        PacketHeader* header = NULL;
+        if (state->tag_filter_count > 0) filter = PacketFindTagFilter(state, tag);
+        if (state->skim) state->header_count++;
+        
+        if (!state->skim && (state->tag_filter_count == 0 || filter != NULL)) {
+            header = (borrow) ? PacketHeaderPushBackBorrowed(packet, tag) : PacketHeaderPushBack(packet, tag);
+            PacketHeaderReserveElements(header, jd_Min(element_count, (in.count - index) / 3)); // an element is at least 3 bytes
+        }
+        
+        for (u64 i = 0; i < element_count; i++) {
+            u64 element_start = index;
+            if (index >= in.count) {
+                PacketSetError(packet, PACKET_INCOMPLETE_ELEMENT, 0, element_start);
+                return false;
+            }
+            
+            u8 type = in.mem[index++];
+            if (type == PACKET_ELEMENT_VALUE_TYPE_NULL || type >= PACKET_ELEMENT_VALUE_TYPE_COUNT) {
+                PacketSetError(packet, PACKET_UNKNOWN_TYPE, 0, element_start);
+                return false;
+            }
+            
+            PacketElement element = {0};
+            element.value_type = type;
+            if (state->skim) state->element_count++;
+            
+            u64 key_count = 0;
+            if (!PacketReadVarint(in, &index, &key_count) || key_count > in.count - index) {
+                PacketSetError(packet, PACKET_INCOMPLETE_ELEMENT, 0, element_start);
+                return false;
+            }
+            
+            element.key.mem = &in.mem[index];
+            element.key.count = key_count;
+            index += key_count;
+            
+            if (type == PACKET_ELEMENT_VALUE_TYPE_STRING) {
+                u64 str_count = 0;
+                if (!PacketReadVarint(in, &index, &str_count) || str_count > in.count - index) {
+                    PacketSetError(packet, PACKET_INCOMPLETE_ELEMENT, 0, element_start);
+                    return false;
+                }
                 
-                case PACKET_ELEMENT_VALUE_TYPE_STRING:
-                b32 string_w = jd_ArenaStrAppendCountAndStr(packet_str, header->elements[i]->data.str);
-                break;
+                element.data.str.mem = &in.mem[index];
+                element.data.str.count = str_count;
+                index += str_count;
+            }
+            
+            else {
+                u64 size = packet_type_sizes[type];
+                if (size > in.count - index) {
+                    PacketSetError(packet, PACKET_INCOMPLETE_ELEMENT, 0, element_start);
+                    return false;
+                }
+                
+                jd_MemCpy(&element.data, &in.mem[index], size);
+                index += size;
+            }
+            
+            if (header == NULL) continue;
+            if (filter != NULL && filter->key_count > 0 && !PacketTagFilterHasKey(filter, element.key)) continue;
+            
+            if (borrow) {
+                PacketElementPushBackBorrowed(header, &element);
             }
             
-            b32 semic_w = jd_ArenaStrAppendStr(packet_str, semic_s);
+            else {
+                if (type == PACKET_ELEMENT_VALUE_TYPE_STRING) element.data.str = jd_StringPush(packet->arena, element.data.str);
+                PacketElementPushBack(header, &element);
+            }
+        }
+    }
+    
+    return true;
+}
+
+// NOTE(JD): Input starting with the binary prefix (see PacketToBinary) is parsed as binary; anything
+// else as text.
+jdat_Packet* PacketParseWithOptions(jd_Arena* arena, jd_String packet_string, PacketParseOptions* options) {
+    jdat_Packet* packet = PacketCreate(arena);
+    b32 borrow = (options != NULL && (options->flags & PACKET_PARSE_BORROW_STRINGS));
+    if (options != NULL) packet->symbols = options->symbols;
+    
+    PacketParseState state = {0};
+    state.required_char = '@';
+    state.lazy = (options != NULL && (options->flags & PACKET_PARSE_LAZY));
+    if (options != NULL) {
+        state.tag_filters = options->tag_filters;
+        state.tag_filter_count = options->tag_filter_count;
+    }
+    
+    if (PacketIsBinary(packet_string)) PacketParseBinary(packet, &state, packet_string, borrow);
+    else PacketParseRun(packet, &state, packet_string, borrow, true);
+    
+    return packet;
+}
+
+// NOTE(JD): Walks packet_string with the PacketParse grammar and hands each header and element to the
+// visitor instead of building a packet. Nothing is allocated. Tags, keys and string values passed to the
+// callbacks are views into packet_string. Returns the same error PacketParse would have set.
+PacketError PacketVisit(jd_String packet_string, jdat_Visitor* visitor) {
+    jdat_Packet scratch = {0};
+    scratch.error.success = true;
+    
+    PacketParseState state = {0};
+    state.required_char = '@';
+    state.visitor = visitor;
+    PacketParseRun(&scratch, &state, packet_string, true, true);
+    
+    return scratch.error;
+}
+
+// NOTE(JD): Decodes the elements of a header from a PACKET_PARSE_LAZY parse. Everything that reads
+// elements through the API calls this first, so callers only need it when reading header->elements
+// directly. Returns false if the header's text turns out to be malformed; the elements before the
+// error are kept. Not thread-safe: materialize a header from one thread at a time.
+b32 PacketHeaderMaterialize(PacketHeader* header) {
+    if (!header->lazy) return true;
+    header->lazy = false;
+    
+    jdat_Packet scratch = {0};
+    scratch.arena = header->arena;
+    scratch.error.success = true;
+    
+    PacketParseState state = {0};
+    state.required_char = '=';
+    state.header = header;
+    return PacketParseRun(&scratch, &state, header->lazy_source, true, true);
+}
+
+jdat_Packet* PacketParse(jd_Arena* arena, jd_String packet_string) {
+    return PacketParseWithOptions(arena, packet_string, NULL);
+}
+
+// NOTE(JD): The most a parse allocates per header and per element, on top of copies of the input's own
+// bytes. Hash indices are kept half full and the old table is left behind when one doubles, so a
+// header can leave up to eight tag index slots behind it and an element up to eight key index slots.
+// The element array doubles the same way, leaving up to four element structs per element. The fixed
+// part covers arena alignment on each copied string.
+#define PACKET_PARSE_HEADER_ARENA_BYTES  (sizeof(PacketHeader) + 8 * sizeof(PacketTagSlot) + 64)
+#define PACKET_PARSE_ELEMENT_ARENA_BYTES (4 * sizeof(PacketElement) + 8 * sizeof(PacketKeySlot) + 64)
+
+static u64 PacketParseArenaBound(u64 input_size, u64 header_count, u64 element_count) {
+    return KILOBYTES(64) + input_size + header_count * PACKET_PARSE_HEADER_ARENA_BYTES + element_count * PACKET_PARSE_ELEMENT_ARENA_BYTES;
+}
+
+typedef struct PacketParseJob {
+    jd_String chunk;
+    u64 chunk_offset;
+    PacketParseOptions* options;
+    jd_Arena* arena;
+    jdat_Packet* packet;
+    PacketThread thread;
+    b32 threaded;
+} PacketParseJob;
+
+static void PacketParseJobRun(PacketParseJob* job) {
+    job->packet = PacketParseWithOptions(job->arena, job->chunk, job->options);
+}
+
+JDAT_THREAD_PROC(PacketParseJobThreadProc) {
+    PacketParseJobRun((PacketParseJob*)param);
+    JDAT_THREAD_RETURN;
+}
+
+// NOTE(JD): The input is split at header starts found by a skim pass, which walks the grammar and skips
+// string payloads by length, so an '@' inside a payload is never taken for a header. Each range is parsed
+// on its own thread into its own arena, and the results are joined in order. If the skim pass finds the
+// input malformed, this falls back to PacketParseWithOptions so the error is reported the same way.
+// The worker arenas own the headers; they are kept on the packet and freed with PacketReleaseWorkerArenas.
+jdat_Packet* PacketParseParallel(jd_Arena* arena, jd_String packet_string, PacketParseOptions* options, u32 thread_count) {
+    thread_count = jd_Min(thread_count, PACKET_MAX_THREADS);
+    if (thread_count <= 1 || packet_string.count < PACKET_PARALLEL_MIN_BYTES || PacketIsBinary(packet_string)) {
+        return PacketParseWithOptions(arena, packet_string, options);
+    }
+    
+    u64 starts[PACKET_MAX_THREADS + 1] = {0};
+    u32 job_count = 1;
+    
+    jdat_Packet skim_packet = {0};
+    skim_packet.error.success = true;
+    PacketParseState skim = {0};
+    skim.required_char = '@';
+    skim.skim = true;
+    
+    u64 header_counts[PACKET_MAX_THREADS] = {0};
+    u64 element_counts[PACKET_MAX_THREADS] = {0};
+    for (u32 i = 1; i <= thread_count; i++) {
+        u64 headers_before = skim.header_count;
+        u64 elements_before = skim.element_count;
+        skim.stop_index = (i < thread_count) ? jd_Max((packet_string.count / thread_count) * i, starts[job_count - 1] + 1) : packet_string.count;
+        if (!PacketParseRun(&skim_packet, &skim, packet_string, false, true)) {
+            return PacketParseWithOptions(arena, packet_string, options);
         }
         
-        b32 c_brac_w = jd_ArenaStrAppendStr(packet_str, c_bracket_s);
+        header_counts[job_count - 1] = skim.header_count - headers_before;
+        element_counts[job_count - 1] = skim.element_count - elements_before;
+        if (skim.index >= packet_string.count) break;
+        starts[job_count++] = skim.index;
+    }
+    
+    starts[job_count] = packet_string.count;
+    
+    // NOTE(JD): A symbol table is not thread-safe, so workers parse without one and the joined packet is
+    // interned afterwards.
+    PacketParseOptions worker_options = {0};
+    if (options != NULL) worker_options = *options;
+    worker_options.symbols = NULL;
+    
+    PacketParseJob jobs[PACKET_MAX_THREADS] = {0};
+    for (u32 i = 0; i < job_count; i++) {
+        PacketParseJob* job = &jobs[i];
+        job->chunk.mem = &packet_string.mem[starts[i]];
+        job->chunk.count = starts[i + 1] - starts[i];
+        job->chunk_offset = starts[i];
+        job->options = &worker_options;
+        job->arena = jd_ArenaCreate(PacketParseArenaBound(job->chunk.count, header_counts[i], element_counts[i]), 0);
         
-        header = header->next;
-        if (header == packet->tail->next) break;
+        if (i > 0) {
+            job->threaded = PacketThreadStart(&job->thread, PacketParseJobThreadProc, job);
+            if (!job->threaded) PacketParseJobRun(job);
+        }
     }
     
-    if (!use_passed_arenastr) {
-        jd_String dup_str = jd_StringPush(arena, packet_str->str);
-        jd_ArenaStrRelease(packet_str);
-        return dup_str;
+    PacketParseJobRun(&jobs[0]);
+    
+    jdat_Packet* packet = PacketCreate(arena);
+    packet->worker_arenas = jd_ArenaAlloc(arena, sizeof(jd_Arena*) * job_count);
+    packet->worker_arena_count = job_count;
+    
+    for (u32 i = 0; i < job_count; i++) {
+        PacketParseJob* job = &jobs[i];
+        if (job->threaded) PacketThreadJoin(job->thread);
+        packet->worker_arenas[i] = job->arena;
+        
+        if (!packet->error.success) continue;
+        
+        PacketJoinToBack(packet, job->packet);
+        if (!job->packet->error.success) {
+            PacketError* error = &job->packet->error;
+            PacketSetError(packet, error->code, error->missing_char, job->chunk_offset + error->error_index);
+        }
     }
-    else {
-        return packet_str->str;
+    
+    if (options != NULL && options->symbols != NULL) PacketSetSymbolTable(packet, options->symbols);
+    return packet;
+}
+
+void PacketReleaseWorkerArenas(jdat_Packet* packet) {
+    for (u32 i = 0; i < packet->worker_arena_count; i++) {
+        jd_ArenaRelease(packet->worker_arenas[i]);
     }
+    
+    packet->worker_arenas = NULL;
+    packet->worker_arena_count = 0;
 }
 
-u64 PacketCalcStringLength(jdat_Packet* packet) {
-    PacketHeader* header = packet->head;
-    u64 calc_count = 0;
-    while (header != NULL) {
-        calc_count += header->text_size;
-        header = header->next;
-        if (header == packet->tail->next) break;
+// NOTE(JD): Each thread takes a slot the first time it touches a pool, shared by all pools, and gives it
+// back when it exits. Slots are bits in packet_pool_slots_used. The exit hook is a pthread key destructor
+// (a fiber-local storage callback on Windows), and the exchange on the bitmap orders the old owner's
+// writes to its caches before the next owner's reads. While every slot is taken, a thread bypasses the
+// free lists and creates and releases arenas directly, and tries again for a slot on its next call.
+_Static_assert(PACKET_MAX_THREADS <= 64, "pool thread slots are the bits of a u64");
+
+static volatile u64 packet_pool_slots_used = 0;
+static JDAT_THREAD_LOCAL u32 packet_pool_thread_slot = 0; // slot + 1, 0 while the thread has none
+
+static void PacketPoolSlotRelease(void* value) {
+    u32 slot = (u32)(size_t)value - 1;
+    u64 used = PacketAtomicLoad64(&packet_pool_slots_used);
+    while (!PacketAtomicCompareExchange64(&packet_pool_slots_used, &used, used & ~(1ull << slot))) {}
+    packet_pool_thread_slot = 0;
+}
+
+#if defined(_WIN32)
+static DWORD packet_pool_exit_key = FLS_OUT_OF_INDEXES;
+static INIT_ONCE packet_pool_exit_key_once = INIT_ONCE_STATIC_INIT;
+
+static VOID WINAPI PacketPoolThreadExit(PVOID value) {
+    if (value != NULL) PacketPoolSlotRelease(value);
+}
+
+static BOOL CALLBACK PacketPoolExitKeyCreate(PINIT_ONCE once, PVOID param, PVOID* context) {
+    packet_pool_exit_key = FlsAlloc(PacketPoolThreadExit);
+    return TRUE;
+}
+
+static void PacketPoolOnThreadExit(u32 slot_plus_one) {
+    InitOnceExecuteOnce(&packet_pool_exit_key_once, PacketPoolExitKeyCreate, NULL, NULL);
+    if (packet_pool_exit_key != FLS_OUT_OF_INDEXES) FlsSetValue(packet_pool_exit_key, (PVOID)(size_t)slot_plus_one);
+}
+#else
+static pthread_key_t packet_pool_exit_key;
+static pthread_once_t packet_pool_exit_key_once = PTHREAD_ONCE_INIT;
+
+static void PacketPoolExitKeyCreate(void) {
+    pthread_key_create(&packet_pool_exit_key, PacketPoolSlotRelease);
+}
+
+static void PacketPoolOnThreadExit(u32 slot_plus_one) {
+    pthread_once(&packet_pool_exit_key_once, PacketPoolExitKeyCreate);
+    pthread_setspecific(packet_pool_exit_key, (void*)(size_t)slot_plus_one);
+}
+#endif
+
+static u32 PacketPoolSlotAcquire(void) {
+    u64 used = PacketAtomicLoad64(&packet_pool_slots_used);
+    u64 all = (PACKET_MAX_THREADS == 64) ? ~0ull : ((1ull << PACKET_MAX_THREADS) - 1);
+    while ((used & all) != all) {
+        u32 slot = (u32)PacketCountTrailingZeros(~used);
+        if (PacketAtomicCompareExchange64(&packet_pool_slots_used, &used, used | (1ull << slot))) {
+            PacketPoolOnThreadExit(slot + 1);
+            return slot + 1;
+        }
     }
-    return calc_count;
+    
+    return 0;
 }
 
-jd_String o_bracket_s = jd_StrConst(" {\n");
-jd_String equals_s = jd_StrConst(" = ");
-jd_String semic_s = jd_StrConst(";\n");
-jd_String c_bracket_s = jd_StrConst("}\n");
+static PacketPoolCache* PacketPoolThreadCache(jdat_PacketPool* pool) {
+    if (packet_pool_thread_slot == 0) packet_pool_thread_slot = PacketPoolSlotAcquire();
+    if (packet_pool_thread_slot == 0) {
+        PacketAtomicIncrement(&pool->uncached_calls);
+        return NULL;
+    }
+    
+    return &pool->caches[packet_pool_thread_slot - 1];
+}
 
-const jd_String element_type_strings[PACKET_ELEMENT_VALUE_TYPE_COUNT] = {
-    jd_StrConst("NULL:"),
-    jd_StrConst("u64:"),
-    jd_StrConst("u32:"),
-    jd_StrConst("i64:"),
-    jd_StrConst("i32:"),
-    jd_StrConst("f64:"),
-    jd_StrConst("f32:"),
-    jd_StrConst("b32:"),
-    jd_StrConst("c8:"),
-    jd_StrConst("string:")
-};
+static PacketPoolEntry* PacketPoolEntryCreate(jdat_PacketPool* pool, PacketPoolCache* cache) {
+    jd_Arena* arena = jd_ArenaCreate(pool->arena_capacity, 0);
+    PacketPoolEntry* entry = jd_ArenaAlloc(arena, sizeof(*entry));
+    entry->arena = arena;
+    entry->base_pos = PacketArenaMark(arena);
+    if (cache != NULL) cache->arenas_created++;
+    return entry;
+}
 
-b32 PacketHeaderAppendToArenaStr(PacketHeader* header, jd_ArenaStr* arena_str, b32 limit_value_string_len, u64 max_value_string_len) {
-    if (header->num_elements == 0) return false;
-    b32 at_w = jd_ArenaStrAppendC8(arena_str, '@');
-    b32 tag_w = jd_ArenaStrAppendStr(arena_str, header->tag);
-    b32 o_brac_w = jd_ArenaStrAppendStr(arena_str, o_bracket_s);
+// NOTE(JD): warm_count arenas are created up front on the calling thread's free list.
+jdat_PacketPool* PacketPoolCreate(jd_Arena* arena, u64 arena_capacity, u32 warm_count) {
+    jdat_PacketPool* pool = jd_ArenaAlloc(arena, sizeof(*pool));
+    pool->arena_capacity = (arena_capacity > 0) ? arena_capacity : PACKET_POOL_ARENA_CAPACITY;
+    pool->max_free_per_thread = PACKET_POOL_MAX_FREE_PER_THREAD;
     
-    for (u32 i = 0; i < header->num_elements; i++) {
-        b32 key_w = jd_ArenaStrAppendStr(arena_str, header->elements[i]->key);
-        b32 equal_w = jd_ArenaStrAppendStr(arena_str, equals_s);
-        b32 type_s_w = jd_ArenaStrAppendStr(arena_str, element_type_strings[header->elements[i]->value_type]);
-        switch (header->elements[i]->value_type) {
-            case PACKET_ELEMENT_VALUE_TYPE_U64:
-            case PACKET_ELEMENT_VALUE_TYPE_U32:
-            case PACKET_ELEMENT_VALUE_TYPE_S64:
-            case PACKET_ELEMENT_VALUE_TYPE_S32:
-            case PACKET_ELEMENT_VALUE_TYPE_F64:
-            case PACKET_ELEMENT_VALUE_TYPE_F32:
-            case PACKET_ELEMENT_VALUE_TYPE_B32:
-            case PACKET_ELEMENT_VALUE_TYPE_C8:
-            b32 data = jd_ArenaStrAppendBin(arena_str, &header->elements[i]->data, packet_type_sizes[header->elements[i]->value_type]);
-            break;
-            
-            case PACKET_ELEMENT_VALUE_TYPE_STRING:
-            if (limit_value_string_len) {
-                jd_String trunc_str = header->elements[i]->data.str;
-                trunc_str.count = max_value_string_len;
-                b32 string_w = jd_ArenaStrAppendCountAndStr(arena_str, trunc_str);
-            }
-            
-            else {
-                b32 string_w = jd_ArenaStrAppendCountAndStr(arena_str, header->elements[i]->data.str);
-                // append some sort of ellipses?
-            }
-            
-            break;
+    PacketPoolCache* cache = PacketPoolThreadCache(pool);
+    for (u32 i = 0; i < warm_count && cache != NULL; i++) {
+        PacketPoolEntry* entry = PacketPoolEntryCreate(pool, cache);
+        entry->next = cache->free;
+        cache->free = entry;
+        cache->free_count++;
+    }
+    
+    return pool;
+}
+
+// NOTE(JD): Releases every arena on the pool's free lists. No thread may be using the pool, and packets
+// still out are not released; release them with PacketPoolRelease first.
+void PacketPoolDestroy(jdat_PacketPool* pool) {
+    for (u32 i = 0; i < PACKET_MAX_THREADS; i++) {
+        PacketPoolCache* cache = &pool->caches[i];
+        while (cache->free != NULL) {
+            PacketPoolEntry* entry = cache->free;
+            cache->free = entry->next;
+            jd_ArenaRelease(entry->arena);
         }
         
-        b32 semic_w = jd_ArenaStrAppendStr(arena_str, semic_s);
+        cache->free_count = 0;
     }
-    
-    b32 c_brac_w = jd_ArenaStrAppendStr(arena_str, c_bracket_s);
-    return true;
 }
 
-void PacketJoinToBack(jdat_Packet* to_packet, jdat_Packet* from_packet) {
-    if (to_packet->tail == NULL) { to_packet->tail = from_packet->head; to_packet->head = from_packet->head; }
-    else to_packet->tail->next = from_packet->head; 
+static PacketPoolEntry* PacketPoolTake(jdat_PacketPool* pool) {
+    PacketPoolCache* cache = PacketPoolThreadCache(pool);
+    PacketPoolEntry* entry = NULL;
+    if (cache != NULL && cache->free != NULL) {
+        entry = cache->free;
+        cache->free = entry->next;
+        cache->free_count--;
+        entry->next = NULL;
+    }
     
-    to_packet->tail = from_packet->tail;
+    else {
+        entry = PacketPoolEntryCreate(pool, cache);
+    }
+    
+    if (cache != NULL) cache->acquires++;
+    return entry;
 }
 
-b32 PacketCopyToBack(jd_Arena* arena, jdat_Packet* to_packet, jdat_Packet* from_packet) {
-    b32 success = true;
-    PacketHeader* from_head = from_packet->head;
-    PacketHeader* from_last = from_packet->tail;
-    
-    jdat_Packet* from_copy = PacketCreate(arena);
+// NOTE(JD): Hands out an empty packet whose arena comes from the calling thread's free list. Nothing is
+// locked: a packet may be released on any thread, and its arena joins that thread's list.
+jdat_Packet* PacketPoolAcquire(jdat_PacketPool* pool) {
+    PacketPoolEntry* entry = PacketPoolTake(pool);
+    jdat_Packet* packet = PacketCreate(entry->arena);
+    packet->pool_entry = entry;
+    return packet;
+}
+
+jdat_Packet* PacketPoolParse(jdat_PacketPool* pool, jd_String packet_string, PacketParseOptions* options) {
+    PacketPoolEntry* entry = PacketPoolTake(pool);
+    jdat_Packet* packet = PacketParseWithOptions(entry->arena, packet_string, options);
+    packet->pool_entry = entry;
+    return packet;
+}
+
+// NOTE(JD): The packet's arena is reset, not freed, so everything allocated in it (the packet, its headers,
+// copied strings) is gone. Past max_free_per_thread free arenas on this thread, the arena is released.
+void PacketPoolRelease(jdat_PacketPool* pool, jdat_Packet* packet) {
+    PacketPoolEntry* entry = packet->pool_entry;
+    jd_Assert(entry != NULL);
+    PacketReleaseWorkerArenas(packet);
     
-    if (from_copy == NULL) {
-        success = false;
-        return success;
+    PacketPoolCache* cache = PacketPoolThreadCache(pool);
+    u64 used = PacketArenaMark(entry->arena);
+    if (cache != NULL) {
+        cache->releases++;
+        cache->high_water_bytes = jd_Max(cache->high_water_bytes, used);
+        if (used > entry->high_water) cache->total_high_water_bytes += (i64)(used - entry->high_water);
     }
     
-    while (from_head != NULL && from_head != from_last->next) {
-        PacketHeader* header = PacketHeaderPushBack(from_copy, from_head->tag);
-        for (u64 i = 0; i < from_head->num_elements; i++) {
-            PacketElement* element = PacketElementPushBack(header, from_head->elements[i]);
+    entry->high_water = jd_Max(entry->high_water, used);
+    
+    if (cache == NULL || cache->free_count >= pool->max_free_per_thread) {
+        if (cache != NULL) {
+            cache->arenas_released++;
+            cache->total_high_water_bytes -= (i64)entry->high_water;
         }
         
-        from_head = from_head->next;
+        jd_ArenaRelease(entry->arena);
+        return;
     }
     
-    PacketJoinToBack(to_packet, from_copy);
-    return true;
+    PacketArenaRewind(entry->arena, entry->base_pos);
+    entry->next = cache->free;
+    cache->free = entry;
+    cache->free_count++;
 }
 
-PacketHeader* PacketHeaderCopy(jd_Arena* arena, PacketHeader* src) {
-    PacketHeader* dst = jd_ArenaAlloc(arena, sizeof(*dst));
-    dst->arena = arena;
-    dst->tag = jd_StringPush(dst->arena, src->tag);
-    dst->num_elements = src->num_elements;
-    for (u64 i = 0; i < dst->num_elements; i++) {
-        dst->elements[i] = jd_ArenaAlloc(arena, sizeof(PacketElement));
-        PacketElement* dst_e = dst->elements[i];
-        dst_e->key = jd_StringPush(dst->arena, src->elements[i]->key);
-        dst_e->value_type = src->elements[i]->value_type;
-        if (dst_e->value_type != PACKET_ELEMENT_VALUE_TYPE_STRING)
-            dst_e->data = src->elements[i]->data;
-        else 
-            dst_e->data.str = jd_StringPush(arena, src->elements[i]->data.str);
+// NOTE(JD): Sums the per-thread counters without synchronizing, so it is approximate while other threads
+// are using the pool. Growth and release of an arena are counted on whichever thread saw them, so a
+// single thread's total can go negative; only the sum means anything.
+PacketPoolStats PacketPoolGetStats(jdat_PacketPool* pool) {
+    PacketPoolStats stats = {0};
+    i64 total_high_water = 0;
+    for (u32 i = 0; i < PACKET_MAX_THREADS; i++) {
+        PacketPoolCache* cache = &pool->caches[i];
+        stats.arenas_created += cache->arenas_created;
+        stats.arenas_released += cache->arenas_released;
+        stats.acquires += cache->acquires;
+        stats.releases += cache->releases;
+        stats.free_arenas += cache->free_count;
+        stats.high_water_bytes = jd_Max(stats.high_water_bytes, cache->high_water_bytes);
+        total_high_water += cache->total_high_water_bytes;
     }
-    dst->text_size = src->text_size;
-    return dst;
+    
+    stats.total_high_water_bytes = (u64)jd_Max(total_high_water, 0);
+    stats.uncached_calls = pool->uncached_calls;
+    return stats;
+}
+
+static jd_String PacketMapFile(jd_Arena* arena, jd_String path) {
+    jd_String view = {0};
+    c8* path_z = jd_ArenaAlloc(arena, path.count + 1);
+    jd_MemCpy(path_z, path.mem, path.count);
+    path_z[path.count] = 0;
+    
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path_z, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) return view;
+    
+    LARGE_INTEGER size = {0};
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) { CloseHandle(file); return view; }
+    
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL) return view;
+    
+    void* mem = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (mem == NULL) return view;
+    
+#if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0602
+    WIN32_MEMORY_RANGE_ENTRY range = { .VirtualAddress = mem, .NumberOfBytes = (SIZE_T)size.QuadPart };
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+    
+    view.mem = mem;
+    view.count = (u64)size.QuadPart;
+#else
+    int fd = open(path_z, O_RDONLY);
+    if (fd < 0) return view;
+    
+    struct stat st = {0};
+    if (fstat(fd, &st) != 0 || st.st_size == 0) { close(fd); return view; }
+    
+    void* mem = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) return view;
+    
+    madvise(mem, (size_t)st.st_size, MADV_SEQUENTIAL);
+    madvise(mem, (size_t)st.st_size, MADV_WILLNEED);
+    
+    view.mem = mem;
+    view.count = (u64)st.st_size;
+#endif
+    
+    return view;
+}
+
+// NOTE(JD): Maps the file read-only and parses it in place: the packet's tags, keys and strings point into
+// the mapping, so the page cache backs them instead of the heap. PACKET_PARSE_BORROW_STRINGS is always on.
+// The mapping lives until PacketCloseFile; nothing from the packet may be used after that.
+jdat_Packet* PacketOpenFile(jd_Arena* arena, jd_String path, PacketParseOptions* options) {
+    jd_String view = PacketMapFile(arena, path);
+    if (view.mem == NULL) {
+        jd_LogError("Could not open or map jdat file.", jd_Error_BadInput, jd_Error_Critical);
+        return 0;
+    }
+    
+    PacketParseOptions file_options = {0};
+    if (options != NULL) file_options = *options;
+    file_options.flags |= PACKET_PARSE_BORROW_STRINGS;
+    
+    jdat_Packet* packet = PacketParseWithOptions(arena, view, &file_options);
+    packet->file_view = view;
+    return packet;
+}
+
+void PacketCloseFile(jdat_Packet* packet) {
+    if (packet->file_view.mem == NULL) return;
+    
+#if defined(_WIN32)
+    UnmapViewOfFile(packet->file_view.mem);
+#else
+    munmap(packet->file_view.mem, (size_t)packet->file_view.count);
+#endif
+    
+    packet->file_view.mem = NULL;
+    packet->file_view.count = 0;
+}
+
+jdat_Parser* PacketParserCreate(jd_Arena* arena) {
+    jdat_Parser* parser = jd_ArenaAlloc(arena, sizeof(*parser));
+    parser->arena = jd_ArenaCreate(PACKET_PARSER_ARENA_CAPACITY, 0);
+    parser->arena_base = PacketArenaMark(parser->arena);
+    parser->scratch = jd_ArenaCreate(PACKET_PARSER_ARENA_CAPACITY, 0);
+    parser->scratch_base = PacketArenaMark(parser->scratch);
+    parser->pending_mark = parser->scratch_base;
+    parser->packet = PacketCreate(arena);
+    parser->packet->arena = parser->arena;
+    parser->state.required_char = '@';
+    return parser;
+}
+
+// NOTE(JD): Growing while bytes are pending leaves the old buffer behind in the scratch arena. It is
+// reclaimed the next time nothing is pending, so the scratch arena stays under twice the largest buffer.
+static b32 PacketParserReserve(jdat_Parser* parser, u64 count) {
+    b32 live = (parser->pending_count > 0);
+    b32 stale = (parser->pending_mark != parser->scratch_base);
+    if (count <= parser->pending_capacity && (live || !stale)) return true;
+    
+    u64 capacity = parser->pending_capacity;
+    if (count > capacity) capacity = jd_Max(jd_Max(count, capacity * 2), KILOBYTES(64));
+    if (!live) PacketArenaRewind(parser->scratch, parser->scratch_base);
+    
+    u64 mark = PacketArenaMark(parser->scratch);
+    u8* pending = jd_ArenaAlloc(parser->scratch, capacity);
+    if (pending == NULL) {
+        PacketSetError(parser->packet, PACKET_OUT_OF_MEMORY, 0, parser->state.base_offset + parser->state.index);
+        return false;
+    }
+    
+    if (live) {
+        jd_MemCpy(pending, parser->pending, parser->pending_count);
+    }
+    
+    parser->pending = pending;
+    parser->pending_capacity = capacity;
+    parser->pending_mark = mark;
+    return true;
+}
+
+// NOTE(JD): Keeps only the bytes the state machine still needs (the token in progress, and the key
+// if the element value has not arrived yet) and rebases the state onto them.
+static b32 PacketParserKeepTail(jdat_Parser* parser, jd_String input) {
+    PacketParseState* state = &parser->state;
+    u64 keep = state->index;
+    if (state->required_char == '{' || state->required_char == '=' || state->required_char == ':') {
+        keep = jd_Min(keep, state->str_in_progress_index);
+    }
+    
+    if (state->required_char == ':') {
+        keep = jd_Min(keep, state->key_index);
+    }
+    
+    u64 tail_count = input.count - keep;
+    if (input.mem == parser->pending) {
+        if (keep > 0) {
+            for (u64 i = 0; i < tail_count; i++) {
+                parser->pending[i] = parser->pending[keep + i];
+            }
+        }
+    }
+    
+    else if (tail_count > 0) {
+        if (!PacketParserReserve(parser, tail_count)) return false;
+        jd_MemCpy(parser->pending, &input.mem[keep], tail_count);
+    }
+    
+    parser->pending_count = tail_count;
+    
+    state->base_offset += keep;
+    state->index -= keep;
+    state->str_in_progress_index = (state->str_in_progress_index >= keep) ? state->str_in_progress_index - keep : 0;
+    state->key_index = (state->key_index >= keep) ? state->key_index - keep : 0;
+    return true;
+}
+
+b32 PacketParserFeed(jdat_Parser* parser, jd_String chunk) {
+    if (!parser->packet->error.success) return false;
+    
+    jd_String input = chunk;
+    if (parser->pending_count > 0) {
+        if (!PacketParserReserve(parser, parser->pending_count + chunk.count)) return false;
+        jd_MemCpy(&parser->pending[parser->pending_count], chunk.mem, chunk.count);
+        parser->pending_count += chunk.count;
+        input.mem = parser->pending;
+        input.count = parser->pending_count;
+    }
+    
+    if (!PacketParseRun(parser->packet, &parser->state, input, false, false)) return false;
+    
+    return PacketParserKeepTail(parser, input);
+}
+
+b32 PacketParserFinish(jdat_Parser* parser) {
+    if (!parser->packet->error.success) return false;
+    
+    jd_String input = {
+        .mem = parser->pending,
+        .count = parser->pending_count
+    };
+    
+    return PacketParseRun(parser->packet, &parser->state, input, false, true);
+}
+
+PacketHeader* PacketParserNextHeader(jdat_Parser* parser) {
+    PacketHeader* header = (parser->last_emitted) ? parser->last_emitted->next : parser->packet->head;
+    if (header == NULL || header == parser->state.header) return NULL;
+    
+    parser->last_emitted = header;
+    return header;
+}
+
+static void PacketParserClearPacket(jdat_Parser* parser) {
+    jdat_Packet* packet = parser->packet;
+    PacketArenaRewind(parser->arena, parser->arena_base);
+    packet->head = NULL;
+    packet->tail = NULL;
+    packet->tag_index = NULL;
+    packet->tag_index_capacity = 0;
+    packet->tag_count = 0;
+    parser->last_emitted = NULL;
+}
+
+// NOTE(JD): Drops the headers PacketParserNextHeader has handed out; pointers to them are invalid afterwards.
+// Once everything parsed so far has been handed out, the parser's arena is rewound, so memory stays
+// bounded by the headers still waiting to be handed out.
+void PacketParserDiscardEmitted(jdat_Parser* parser) {
+    if (parser->last_emitted == NULL) return;
+    
+    if (parser->last_emitted->next == NULL) {
+        PacketParserClearPacket(parser);
+        return;
+    }
+    
+    PacketHeader* keep = parser->last_emitted->next;
+    while (parser->packet->head != keep) {
+        PacketHeaderPop(parser->packet, parser->packet->head);
+    }
+    
+    parser->last_emitted = NULL;
+}
+
+// NOTE(JD): Forgets all input, parsed headers and errors so the parser can start on a new stream.
+void PacketParserReset(jdat_Parser* parser) {
+    PacketParserClearPacket(parser);
+    PacketArenaRewind(parser->scratch, parser->scratch_base);
+    parser->pending = NULL;
+    parser->pending_count = 0;
+    parser->pending_capacity = 0;
+    parser->pending_mark = parser->scratch_base;
+    
+    PacketParseState state = { .required_char = '@' };
+    parser->state = state;
+    parser->packet->error.success = true;
+}
+
+void PacketParserRelease(jdat_Parser* parser) {
+    jd_ArenaRelease(parser->arena);
+    jd_ArenaRelease(parser->scratch);
+    parser->arena = NULL;
+    parser->scratch = NULL;
+}
+
+jd_String o_bracket_s = jd_StrConst(" {\n");
+jd_String equals_s = jd_StrConst(" = ");
+jd_String semic_s = jd_StrConst(";\n");
+jd_String c_bracket_s = jd_StrConst("}\n");
+
+const jd_String element_type_strings[PACKET_ELEMENT_VALUE_TYPE_COUNT] = {
+    jd_StrConst("NULL:"),
+    jd_StrConst("u64:"),
+    jd_StrConst("u32:"),
+    jd_StrConst("i64:"),
+    jd_StrConst("i32:"),
+    jd_StrConst("f64:"),
+    jd_StrConst("f32:"),
+    jd_StrConst("b32:"),
+    jd_StrConst("c8:"),
+    jd_StrConst("string:")
+};
+
+jd_ForceInline u8* PacketWriteBytes(u8* at, void* src, u64 count) {
+    jd_MemCpy(at, src, count);
+    return at + count;
+}
+
+static u64 PacketElementTextSize(PacketElement* element) {
+    u64 size = element->key.count + equals_s.count + element_type_strings[element->value_type].count + semic_s.count;
+    if (element->value_type == PACKET_ELEMENT_VALUE_TYPE_STRING) size += sizeof(u64) + element->data.str.count;
+    else size += packet_type_sizes[element->value_type];
+    return size;
+}
+
+static u8* PacketElementWrite(PacketElement* element, u8* at) {
+    at = PacketWriteBytes(at, element->key.mem, element->key.count);
+    at = PacketWriteBytes(at, equals_s.mem, equals_s.count);
+    at = PacketWriteBytes(at, element_type_strings[element->value_type].mem, element_type_strings[element->value_type].count);
+    
+    if (element->value_type == PACKET_ELEMENT_VALUE_TYPE_STRING) {
+        at = PacketWriteBytes(at, &element->data.str.count, sizeof(u64));
+        at = PacketWriteBytes(at, element->data.str.mem, element->data.str.count);
+    }
+    
+    else {
+        at = PacketWriteBytes(at, &element->data, packet_type_sizes[element->value_type]);
+    }
+    
+    return PacketWriteBytes(at, semic_s.mem, semic_s.count);
+}
+
+static u64 PacketHeaderMeasure(PacketHeader* header) {
+    u64 size = 1 + header->tag.count + o_bracket_s.count + c_bracket_s.count;
+    for (u64 i = 0; i < header->num_elements; i++) {
+        size += PacketElementTextSize(&header->elements[i]);
+    }
+    
+    return size;
+}
+
+// NOTE(JD): Writes the header's text form to out with plain stores and returns the byte count, which is
+// always header->text_size. The caller sizes out from text_size, so a key or string changed by writing
+// through a PacketElement* instead of PacketElementSetByArg would overrun it; debug builds re-measure the
+// header first to catch that. A cached copy of the text is used when there is one, but this never fills
+// the cache, so it is safe to call from worker threads.
+static u64 PacketHeaderWrite(PacketHeader* header, u8* out) {
+    if (header->cached_text.mem != NULL) {
+        jd_MemCpy(out, header->cached_text.mem, header->cached_text.count);
+        return header->cached_text.count;
+    }
+    
+    jd_Assert(PacketHeaderMeasure(header) == header->text_size);
+    
+    u8* at = out;
+    *at++ = '@';
+    at = PacketWriteBytes(at, header->tag.mem, header->tag.count);
+    at = PacketWriteBytes(at, o_bracket_s.mem, o_bracket_s.count);
+    
+    for (u64 i = 0; i < header->num_elements; i++) {
+        at = PacketElementWrite(&header->elements[i], at);
+    }
+    
+    at = PacketWriteBytes(at, c_bracket_s.mem, c_bracket_s.count);
+    jd_Assert((u64)(at - out) <= header->text_size);
+    return (u64)(at - out);
+}
+
+// NOTE(JD): With no arena_str, the output is sized up front from the headers' text_size and written
+// into a single arena allocation. With one, headers are appended to it.
+jd_String PacketToString(jd_Arena* arena, jdat_Packet* packet, jd_ArenaStr* arena_str) {
+    if (arena_str != NULL) {
+        jdat_ForEachHeader(header, packet) {
+            PacketHeaderAppendToArenaStr(header, arena_str, false, 0);
+        }
+        
+        return arena_str->str;
+    }
+    
+    u64 size = PacketCalcStringLength(packet);
+    jd_String out = jd_StringCreateEmpty(arena, size);
+    u64 pos = 0;
+    jdat_ForEachHeader(header, packet) {
+        if (header->num_elements == 0) continue;
+        u64 written = PacketHeaderWrite(header, &out.mem[pos]);
+        PacketHeaderCacheText(header, &out.mem[pos], written);
+        pos += written;
+    }
+    
+    jd_Assert(pos == size);
+    return out;
+}
+
+typedef struct PacketWriteJob {
+    PacketHeader* first;
+    u64 header_count;
+    u8* out;
+    u64 written;
+    PacketThread thread;
+    b32 threaded;
+} PacketWriteJob;
+
+static void PacketWriteJobRun(PacketWriteJob* job) {
+    PacketHeader* header = job->first;
+    for (u64 i = 0; i < job->header_count; i++, header = header->next) {
+        if (header->num_elements == 0) continue;
+        job->written += PacketHeaderWrite(header, &job->out[job->written]);
+    }
+}
+
+JDAT_THREAD_PROC(PacketWriteJobThreadProc) {
+    PacketWriteJobRun((PacketWriteJob*)param);
+    JDAT_THREAD_RETURN;
+}
+
+// NOTE(JD): Every header's output size is known up front (text_size), so the header list is cut into
+// thread_count ranges of roughly equal byte size, each range's offset is the running sum of the sizes
+// before it, and each thread writes its range straight into the shared output. The calling thread takes
+// the first range. Output is byte-identical to PacketToString.
+jd_String PacketToStringParallel(jd_Arena* arena, jdat_Packet* packet, u32 thread_count) {
+    thread_count = jd_Min(thread_count, PACKET_MAX_THREADS);
+    u64 size = PacketCalcStringLength(packet);
+    if (thread_count <= 1 || size < PACKET_PARALLEL_MIN_BYTES) {
+        return PacketToString(arena, packet, NULL);
+    }
+    
+    jd_String out = jd_StringCreateEmpty(arena, size);
+    
+    PacketWriteJob jobs[PACKET_MAX_THREADS] = {0};
+    u32 job_count = 0;
+    u64 range_size = size / thread_count;
+    u64 offset = 0;
+    
+    PacketWriteJob* job = NULL;
+    jdat_ForEachHeader(header, packet) {
+        if (job == NULL || (job_count < thread_count && offset >= range_size * job_count)) {
+            job = &jobs[job_count++];
+            job->first = header;
+            job->out = &out.mem[offset];
+        }
+        
+        job->header_count++;
+        if (header->num_elements > 0) offset += header->text_size;
+    }
+    
+    for (u32 i = 1; i < job_count; i++) {
+        jobs[i].threaded = PacketThreadStart(&jobs[i].thread, PacketWriteJobThreadProc, &jobs[i]);
+        if (!jobs[i].threaded) PacketWriteJobRun(&jobs[i]);
+    }
+    
+    if (job_count > 0) PacketWriteJobRun(&jobs[0]);
+    
+    u64 written = 0;
+    for (u32 i = 0; i < job_count; i++) {
+        if (jobs[i].threaded) PacketThreadJoin(jobs[i].thread);
+        written += jobs[i].written;
+    }
+    
+    jd_Assert(written == size);
+    return out;
+}
+
+static PacketIoVec* PacketIoVecPush(PacketIoVecList* list, void* base, u64 len) {
+    if (len == 0) return NULL;
+    PacketIoVec* vec = &list->vecs[list->count++];
+    vec->base = base;
+    vec->len = len;
+    list->total_size += len;
+    return vec;
+}
+
+// NOTE(JD): Framing and small values are written into one scratch allocation. String values of at least
+// min_reference_size bytes are not copied: their iovec points at the element's own memory, so the packet
+// must stay alive and unchanged until the list has been written. Pass 0 for PACKET_IOVEC_MIN_REFERENCE_SIZE.
+// Writing the vectors in order gives exactly the bytes of PacketToString.
+PacketIoVecList PacketToIoVec(jd_Arena* arena, jdat_Packet* packet, u64 min_reference_size) {
+    if (min_reference_size == 0) min_reference_size = PACKET_IOVEC_MIN_REFERENCE_SIZE;
+    
+    PacketIoVecList list = {0};
+    u64 scratch_size = 0;
+    u64 reference_count = 0;
+    jdat_ForEachHeader(header, packet) {
+        PacketHeaderMaterialize(header);
+        if (header->num_elements == 0) continue;
+        scratch_size += header->text_size;
+        
+        for (u64 i = 0; i < header->num_elements; i++) {
+            PacketElement* element = &header->elements[i];
+            if (element->value_type != PACKET_ELEMENT_VALUE_TYPE_STRING || element->data.str.count < min_reference_size) continue;
+            scratch_size -= element->data.str.count;
+            reference_count++;
+        }
+    }
+    
+    u8* scratch = jd_ArenaAlloc(arena, jd_Max(scratch_size, 1));
+    list.vecs = jd_ArenaAlloc(arena, sizeof(PacketIoVec) * (reference_count * 2 + 1));
+    
+    u8* at = scratch;
+    u8* segment = scratch;
+    jdat_ForEachHeader(header, packet) {
+        if (header->num_elements == 0) continue;
+        *at++ = '@';
+        at = PacketWriteBytes(at, header->tag.mem, header->tag.count);
+        at = PacketWriteBytes(at, o_bracket_s.mem, o_bracket_s.count);
+        
+        for (u64 i = 0; i < header->num_elements; i++) {
+            PacketElement* element = &header->elements[i];
+            if (element->value_type != PACKET_ELEMENT_VALUE_TYPE_STRING || element->data.str.count < min_reference_size) {
+                at = PacketElementWrite(element, at);
+                continue;
+            }
+            
+            at = PacketWriteBytes(at, element->key.mem, element->key.count);
+            at = PacketWriteBytes(at, equals_s.mem, equals_s.count);
+            at = PacketWriteBytes(at, element_type_strings[element->value_type].mem, element_type_strings[element->value_type].count);
+            at = PacketWriteBytes(at, &element->data.str.count, sizeof(u64));
+            
+            PacketIoVecPush(&list, segment, (u64)(at - segment));
+            PacketIoVecPush(&list, element->data.str.mem, element->data.str.count);
+            segment = at;
+            
+            at = PacketWriteBytes(at, semic_s.mem, semic_s.count);
+        }
+        
+        at = PacketWriteBytes(at, c_bracket_s.mem, c_bracket_s.count);
+    }
+    
+    PacketIoVecPush(&list, segment, (u64)(at - segment));
+    jd_Assert((u64)(at - scratch) == scratch_size);
+    return list;
+}
+
+#if !defined(_WIN32)
+// NOTE(JD): PacketWriteIoVec hands vecs straight to writev.
+_Static_assert(sizeof(PacketIoVec) == sizeof(struct iovec), "PacketIoVec must be laid out like struct iovec");
+_Static_assert(offsetof(PacketIoVec, base) == offsetof(struct iovec, iov_base), "PacketIoVec.base must match iov_base");
+_Static_assert(offsetof(PacketIoVec, len) == offsetof(struct iovec, iov_len), "PacketIoVec.len must match iov_len");
+#endif
+
+// NOTE(JD): Writes the whole list to fd, retrying short writes. On POSIX this is writev in batches of up to
+// IOV_MAX vectors. The list is consumed: vectors are advanced past whatever has been written.
+b32 PacketWriteIoVec(int fd, PacketIoVecList* list) {
+    u64 i = 0;
+    while (i < list->count) {
+        if (list->vecs[i].len == 0) { i++; continue; }
+        
+#if defined(_WIN32)
+        int written = _write(fd, list->vecs[i].base, (unsigned int)jd_Min(list->vecs[i].len, (u64)MEGABYTES(512)));
+        if (written <= 0) return false;
+#else
+        int batch = (int)jd_Min(list->count - i, (u64)IOV_MAX);
+        ssize_t written = writev(fd, (struct iovec*)&list->vecs[i], batch);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+#endif
+        
+        u64 remaining = (u64)written;
+        while (remaining > 0) {
+            PacketIoVec* vec = &list->vecs[i];
+            if (remaining >= vec->len) {
+                remaining -= vec->len;
+                vec->len = 0;
+                i++;
+            }
+            
+            else {
+                vec->base = (u8*)vec->base + remaining;
+                vec->len -= remaining;
+                remaining = 0;
+            }
+        }
+    }
+    
+    return true;
+}
+
+static b32 PacketWriterFileFlush(void* user, u8* data, u64 count) {
+    int fd = (int)(intptr_t)user;
+    while (count > 0) {
+#if defined(_WIN32)
+        int written = _write(fd, data, (unsigned int)jd_Min(count, (u64)MEGABYTES(512)));
+#else
+        ssize_t written = write(fd, data, (size_t)jd_Min(count, (u64)MEGABYTES(512)));
+#endif
+        if (written <= 0) return false;
+        data += written;
+        count -= (u64)written;
+    }
+    
+    return true;
+}
+
+// NOTE(JD): The writer stages output in one block and hands it to flush when it fills. With no flush
+// function the block is the destination, and running out of room is an error.
+jdat_Writer* PacketWriterCreate(jd_Arena* arena, u64 block_size, PacketWriterFlushFunc flush, void* user) {
+    jdat_Writer* writer = jd_ArenaAlloc(arena, sizeof(*writer));
+    writer->capacity = (block_size > 0) ? block_size : PACKET_WRITER_BLOCK_SIZE;
+    writer->buf = jd_ArenaAlloc(arena, writer->capacity);
+    writer->flush = flush;
+    writer->user = user;
+    return writer;
+}
+
+jdat_Writer* PacketWriterCreateBuffer(jd_Arena* arena, u8* buf, u64 capacity) {
+    jdat_Writer* writer = jd_ArenaAlloc(arena, sizeof(*writer));
+    writer->buf = buf;
+    writer->capacity = capacity;
+    return writer;
+}
+
+jdat_Writer* PacketWriterCreateFile(jd_Arena* arena, int fd) {
+    return PacketWriterCreate(arena, PACKET_WRITER_BLOCK_SIZE, PacketWriterFileFlush, (void*)(intptr_t)fd);
+}
+
+b32 PacketWriterFlush(jdat_Writer* writer) {
+    if (writer->failed) return false;
+    if (writer->flush == NULL || writer->count == 0) return true;
+    
+    if (!writer->flush(writer->user, writer->buf, writer->count)) {
+        writer->failed = true;
+        return false;
+    }
+    
+    writer->flushed += writer->count;
+    writer->count = 0;
+    return true;
+}
+
+// NOTE(JD): Slow path for output that does not fit in what is left of the block. Anything at least a
+// block long goes straight to flush instead of being copied through the block.
+static b32 PacketWriterWriteSlow(jdat_Writer* writer, void* src, u64 count) {
+    u8* bytes = src;
+    while (count > 0) {
+        if (writer->count == writer->capacity && !PacketWriterFlush(writer)) return false;
+        
+        if (writer->flush == NULL && writer->count + count > writer->capacity) {
+            writer->failed = true;
+            return false;
+        }
+        
+        if (writer->count == 0 && count >= writer->capacity) {
+            if (!writer->flush(writer->user, bytes, count)) {
+                writer->failed = true;
+                return false;
+            }
+            
+            writer->flushed += count;
+            return true;
+        }
+        
+        u64 n = jd_Min(count, writer->capacity - writer->count);
+        jd_MemCpy(&writer->buf[writer->count], bytes, n);
+        writer->count += n;
+        bytes += n;
+        count -= n;
+    }
+    
+    return true;
+}
+
+jd_ForceInline b32 PacketWriterWrite(jdat_Writer* writer, void* src, u64 count) {
+    if (writer->capacity - writer->count < count) return PacketWriterWriteSlow(writer, src, count);
+    jd_MemCpy(&writer->buf[writer->count], src, count);
+    writer->count += count;
+    return true;
+}
+
+// NOTE(JD): Writes str without its whitespace, the same way PacketHeaderPushBack and PacketElementPushBack
+// store tags and keys.
+static b32 PacketWriterWriteStripped(jdat_Writer* writer, jd_String str) {
+    u64 run_start = 0;
+    for (u64 i = 0; i < str.count; i++) {
+        if (!PacketIsWhitespace(str.mem[i])) continue;
+        if (!PacketWriterWrite(writer, &str.mem[run_start], i - run_start)) return false;
+        run_start = i + 1;
+    }
+    
+    return PacketWriterWrite(writer, &str.mem[run_start], str.count - run_start);
+}
+
+// NOTE(JD): The header's opening is held back until its first element, because PacketToString does not
+// write headers that have no elements. The tag must stay valid until then.
+b32 PacketWriterBeginHeader(jdat_Writer* writer, jd_String tag) {
+    jd_Assert(!writer->in_header);
+    writer->tag = tag;
+    writer->in_header = true;
+    writer->header_open = false;
+    return !writer->failed;
+}
+
+b32 PacketWriterEndHeader(jdat_Writer* writer) {
+    jd_Assert(writer->in_header);
+    writer->in_header = false;
+    if (!writer->header_open) return !writer->failed;
+    return PacketWriterWrite(writer, c_bracket_s.mem, c_bracket_s.count);
+}
+
+// NOTE(JD): Like PacketElementPushBack, NULL elements are not written and false is returned.
+b32 PacketWriterPutElement(jdat_Writer* writer, PacketElement* element) {
+    jd_Assert(writer->in_header);
+    if (writer->failed) return false;
+    if (element->value_type == PACKET_ELEMENT_VALUE_TYPE_NULL || element->value_type >= PACKET_ELEMENT_VALUE_TYPE_COUNT) return false;
+    
+    if (!writer->header_open) {
+        writer->header_open = true;
+        u8 at = '@';
+        if (!PacketWriterWrite(writer, &at, 1)) return false;
+        if (!PacketWriterWriteStripped(writer, writer->tag)) return false;
+        if (!PacketWriterWrite(writer, o_bracket_s.mem, o_bracket_s.count)) return false;
+    }
+    
+    PacketElement trimmed = *element;
+    trimmed.key = PacketStringTrim(element->key);
+    b32 key_clean = !PacketStringHasWhitespace(trimmed.key);
+    
+    u64 size = PacketElementTextSize(&trimmed);
+    if (key_clean && writer->capacity - writer->count >= size) {
+        PacketElementWrite(&trimmed, &writer->buf[writer->count]);
+        writer->count += size;
+        return true;
+    }
+    
+    if (!PacketWriterWriteStripped(writer, trimmed.key)) return false;
+    if (!PacketWriterWrite(writer, equals_s.mem, equals_s.count)) return false;
+    if (!PacketWriterWrite(writer, element_type_strings[element->value_type].mem, element_type_strings[element->value_type].count)) return false;
+    
+    if (element->value_type == PACKET_ELEMENT_VALUE_TYPE_STRING) {
+        if (!PacketWriterWrite(writer, &element->data.str.count, sizeof(u64))) return false;
+        if (!PacketWriterWrite(writer, element->data.str.mem, element->data.str.count)) return false;
+    }
+    
+    else {
+        if (!PacketWriterWrite(writer, &element->data, packet_type_sizes[element->value_type])) return false;
+    }
+    
+    return PacketWriterWrite(writer, semic_s.mem, semic_s.count);
+}
+
+b32 PacketWriterPutByArg(jdat_Writer* writer, jd_String key, PacketElementValueType type, PacketElementData data) {
+    PacketElement element = {
+        .key = key,
+        .value_type = type,
+        .data = data
+    };
+    
+    return PacketWriterPutElement(writer, &element);
+}
+
+b32 PacketWriterPutString(jdat_Writer* writer, jd_String key, jd_String val) {
+    return PacketWriterPutByArg(writer, key, PACKET_ELEMENT_VALUE_TYPE_STRING, jdat_ElementByArg(str, val));
+}
+
+b32 PacketWriterPutU64(jdat_Writer* writer, jd_String key, u64 val) {
+    return PacketWriterPutByArg(writer, key, PACKET_ELEMENT_VALUE_TYPE_U64, jdat_ElementByArg(U64, val));
+}
+
+b32 PacketWriterPutU32(jdat_Writer* writer, jd_String key, u32 val) {
+    return PacketWriterPutByArg(writer, key, PACKET_ELEMENT_VALUE_TYPE_U32, jdat_ElementByArg(U32, val));
+}
+
+static u64 PacketVarintSize(u64 value) {
+    u64 size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    
+    return size;
+}
+
+static u8* PacketWriteVarint(u8* at, u64 value) {
+    while (value >= 0x80) {
+        *at++ = (u8)(value | 0x80);
+        value >>= 7;
+    }
+    
+    *at++ = (u8)value;
+    return at;
+}
+
+static u64 PacketHeaderBinarySize(PacketHeader* header) {
+    u64 size = PacketVarintSize(header->tag.count) + header->tag.count + PacketVarintSize(header->num_elements);
+    for (u64 i = 0; i < header->num_elements; i++) {
+        PacketElement* element = &header->elements[i];
+        size += 1 + PacketVarintSize(element->key.count) + element->key.count;
+        if (element->value_type == PACKET_ELEMENT_VALUE_TYPE_STRING) size += PacketVarintSize(element->data.str.count) + element->data.str.count;
+        else size += packet_type_sizes[element->value_type];
+    }
+    
+    return size;
+}
+
+// NOTE(JD): Headers with no elements are not written, as with text.
+u64 PacketCalcBinaryLength(jdat_Packet* packet) {
+    u64 size = PACKET_BINARY_PREFIX_SIZE;
+    jdat_ForEachHeader(header, packet) {
+        PacketHeaderMaterialize(header);
+        if (header->num_elements == 0) continue;
+        size += PacketHeaderBinarySize(header);
+    }
+    
+    return size;
+}
+
+jd_String PacketToBinary(jd_Arena* arena, jdat_Packet* packet) {
+    u64 size = PacketCalcBinaryLength(packet);
+    jd_String out = jd_StringCreateEmpty(arena, size);
+    
+    u8* at = PacketWriteBytes(out.mem, (void*)packet_binary_magic, sizeof(packet_binary_magic));
+    *at++ = PACKET_BINARY_VERSION;
+    
+    jdat_ForEachHeader(header, packet) {
+        if (header->num_elements == 0) continue;
+        at = PacketWriteVarint(at, header->tag.count);
+        at = PacketWriteBytes(at, header->tag.mem, header->tag.count);
+        at = PacketWriteVarint(at, header->num_elements);
+        
+        for (u64 i = 0; i < header->num_elements; i++) {
+            PacketElement* element = &header->elements[i];
+            *at++ = (u8)element->value_type;
+            at = PacketWriteVarint(at, element->key.count);
+            at = PacketWriteBytes(at, element->key.mem, element->key.count);
+            
+            if (element->value_type == PACKET_ELEMENT_VALUE_TYPE_STRING) {
+                at = PacketWriteVarint(at, element->data.str.count);
+                at = PacketWriteBytes(at, element->data.str.mem, element->data.str.count);
+            }
+            
+            else {
+                at = PacketWriteBytes(at, &element->data, packet_type_sizes[element->value_type]);
+            }
+        }
+    }
+    
+    jd_Assert((u64)(at - out.mem) == size);
+    return out;
+}
+
+// NOTE(JD): Conversions between the two framings. The input is skimmed to size a scratch arena, then
+// parsed into it (borrowing its strings); the arena is released before returning. Either direction returns an empty string if the input
+// does not parse; PacketParse it to get the error.
+static jd_String PacketConvert(jd_Arena* arena, jd_String in, b32 to_binary) {
+    jd_String out = {0};
+    jdat_Packet skim_packet = {0};
+    skim_packet.error.success = true;
+    PacketParseState skim = {0};
+    skim.required_char = '@';
+    skim.skim = true;
+    skim.stop_index = in.count;
+    
+    b32 parsed = (PacketIsBinary(in)) ? PacketParseBinary(&skim_packet, &skim, in, true) : PacketParseRun(&skim_packet, &skim, in, true, true);
+    if (!parsed || !skim_packet.error.success) return out;
+    
+    jd_Arena* scratch = jd_ArenaCreate(PacketParseArenaBound(in.count, skim.header_count, skim.element_count), 0);
+    
+    PacketParseOptions options = { .flags = PACKET_PARSE_BORROW_STRINGS };
+    jdat_Packet* packet = PacketParseWithOptions(scratch, in, &options);
+    if (packet->error.success) {
+        out = (to_binary) ? PacketToBinary(arena, packet) : PacketToString(arena, packet, NULL);
+    }
+    
+    jd_ArenaRelease(scratch);
+    return out;
+}
+
+jd_String PacketTextToBinary(jd_Arena* arena, jd_String text) {
+    return PacketConvert(arena, text, true);
+}
+
+jd_String PacketBinaryToText(jd_Arena* arena, jd_String binary) {
+    return PacketConvert(arena, binary, false);
+}
+
+// NOTE(JD): Headers with no elements are not written, so they are not counted.
+u64 PacketCalcStringLength(jdat_Packet* packet) {
+    u64 calc_count = 0;
+    jdat_ForEachHeader(header, packet) {
+        PacketHeaderMaterialize(header);
+        if (header->num_elements == 0) continue;
+        calc_count += header->text_size;
+    }
+    return calc_count;
+}
+
+b32 PacketHeaderAppendToArenaStr(PacketHeader* header, jd_ArenaStr* arena_str, b32 limit_value_string_len, u64 max_value_string_len) {
+    PacketHeaderMaterialize(header);
+    if (header->num_elements == 0) return false;
+    if (!limit_value_string_len && header->cached_text.mem != NULL) {
+        return jd_ArenaStrAppendStr(arena_str, header->cached_text);
+    }
+    
+    u64 start = arena_str->str.count;
+    b32 at_w = jd_ArenaStrAppendC8(arena_str, '@');
+    b32 tag_w = jd_ArenaStrAppendStr(arena_str, header->tag);
+    b32 o_brac_w = jd_ArenaStrAppendStr(arena_str, o_bracket_s);
+    
+    for (u64 i = 0; i < header->num_elements; i++) {
+        b32 key_w = jd_ArenaStrAppendStr(arena_str, header->elements[i].key);
+        b32 equal_w = jd_ArenaStrAppendStr(arena_str, equals_s);
+        b32 type_s_w = jd_ArenaStrAppendStr(arena_str, element_type_strings[header->elements[i].value_type]);
+        switch (header->elements[i].value_type) {
+            case PACKET_ELEMENT_VALUE_TYPE_U64:
+            case PACKET_ELEMENT_VALUE_TYPE_U32:
+            case PACKET_ELEMENT_VALUE_TYPE_S64:
+            case PACKET_ELEMENT_VALUE_TYPE_S32:
+            case PACKET_ELEMENT_VALUE_TYPE_F64:
+            case PACKET_ELEMENT_VALUE_TYPE_F32:
+            case PACKET_ELEMENT_VALUE_TYPE_B32:
+            case PACKET_ELEMENT_VALUE_TYPE_C8:
+            b32 data = jd_ArenaStrAppendBin(arena_str, &header->elements[i].data, packet_type_sizes[header->elements[i].value_type]);
+            break;
+            
+            case PACKET_ELEMENT_VALUE_TYPE_STRING:
+            if (limit_value_string_len) {
+                jd_String trunc_str = header->elements[i].data.str;
+                trunc_str.count = jd_Min(trunc_str.count, max_value_string_len);
+                b32 string_w = jd_ArenaStrAppendCountAndStr(arena_str, trunc_str);
+            }
+            
+            else {
+                b32 string_w = jd_ArenaStrAppendCountAndStr(arena_str, header->elements[i].data.str);
+                // append some sort of ellipses?
+            }
+            
+            break;
+        }
+        
+        b32 semic_w = jd_ArenaStrAppendStr(arena_str, semic_s);
+    }
+    
+    b32 c_brac_w = jd_ArenaStrAppendStr(arena_str, c_bracket_s);
+    u64 written = arena_str->str.count - start;
+    if (!limit_value_string_len && written == header->text_size) PacketHeaderCacheText(header, &arena_str->str.mem[start], written);
+    return true;
+}
+
+void PacketJoinToBack(jdat_Packet* to_packet, jdat_Packet* from_packet) {
+    if (from_packet->head == NULL) return;
+    
+    if (to_packet->tail == NULL) { to_packet->tail = from_packet->head; to_packet->head = from_packet->head; }
+    else { to_packet->tail->next = from_packet->head; from_packet->head->last = to_packet->tail; }
+    
+    to_packet->tail = from_packet->tail;
+    
+    // NOTE(JD): Splice each of from_packet's tag chains onto the end of the matching chain in to_packet.
+    for (u64 i = 0; i < from_packet->tag_index_capacity; i++) {
+        PacketTagSlot* from_s = &from_packet->tag_index[i];
+        if (from_s->tag.mem == NULL || from_s->first == NULL) continue;
+        
+        PacketTagSlot* to_s = PacketTagIndexFind(to_packet, from_s->tag, from_s->hash);
+        if (to_s == NULL) to_s = PacketTagIndexInsert(to_packet, from_s->tag, from_s->hash);
+        
+        if (to_s->last) { to_s->last->next_with_tag = from_s->first; from_s->first->last_with_tag = to_s->last; }
+        else to_s->first = from_s->first;
+        to_s->last = from_s->last;
+    }
+}
+
+b32 PacketCopyToBack(jd_Arena* arena, jdat_Packet* to_packet, jdat_Packet* from_packet) {
+    b32 success = true;
+    PacketHeader* from_head = from_packet->head;
+    PacketHeader* from_last = from_packet->tail;
+    
+    jdat_Packet* from_copy = PacketCreate(arena);
+    
+    if (from_copy == NULL) {
+        success = false;
+        return success;
+    }
+    
+    from_copy->symbols = to_packet->symbols;
+    
+    while (from_head != NULL && from_head != from_last->next) {
+        PacketHeaderMaterialize(from_head);
+        PacketHeader* header = PacketHeaderPushBack(from_copy, from_head->tag);
+        for (u64 i = 0; i < from_head->num_elements; i++) {
+            PacketElement* element = PacketElementPushBack(header, &from_head->elements[i]);
+        }
+        
+        from_head = from_head->next;
+    }
+    
+    PacketJoinToBack(to_packet, from_copy);
+    return true;
+}
+
+PacketHeader* PacketHeaderCopy(jd_Arena* arena, PacketHeader* src) {
+    PacketHeaderMaterialize(src);
+    PacketHeader* dst = jd_ArenaAlloc(arena, sizeof(*dst));
+    dst->arena = arena;
+    dst->tag = jd_StringPush(dst->arena, src->tag);
+    dst->num_elements = src->num_elements;
+    dst->element_capacity = PACKET_HEADER_INLINE_ELEMENTS;
+    dst->elements = dst->inline_elements;
+    if (src->num_elements > PACKET_HEADER_INLINE_ELEMENTS) {
+        dst->element_capacity = src->num_elements;
+        dst->elements = jd_ArenaAlloc(arena, sizeof(PacketElement) * dst->element_capacity);
+    }
+    
+    for (u64 i = 0; i < dst->num_elements; i++) {
+        PacketElement* dst_e = &dst->elements[i];
+        PacketElement* src_e = &src->elements[i];
+        dst_e->key = jd_StringPush(dst->arena, src_e->key);
+        dst_e->value_type = src_e->value_type;
+        if (dst_e->value_type != PACKET_ELEMENT_VALUE_TYPE_STRING)
+            dst_e->data = src_e->data;
+        else 
+            dst_e->data.str = jd_StringPush(arena, src_e->data.str);
+    }
+    dst->text_size = src->text_size;
+    if (dst->num_elements >= PACKET_HEADER_KEY_INDEX_MIN_ELEMENTS) PacketHeaderBuildKeyIndex(dst);
+    return dst;
+}
+
+// NOTE(JD): Records first (block header, header records, element records, all 8-byte aligned), then every
+// tag, key and string's bytes. Empty headers are kept, unlike in the text form.
+u64 PacketCalcBlockSize(jdat_Packet* packet) {
+    u64 size = sizeof(jdat_PacketBlock);
+    jdat_ForEachHeader(header, packet) {
+        PacketHeaderMaterialize(header);
+        size += sizeof(PacketBlockHeader) + header->tag.count;
+        for (u64 i = 0; i < header->num_elements; i++) {
+            PacketElement* element = &header->elements[i];
+            size += sizeof(PacketBlockElement) + element->key.count;
+            if (element->value_type == PACKET_ELEMENT_VALUE_TYPE_STRING) size += element->data.str.count;
+        }
+    }
+    
+    return size;
+}
+
+// NOTE(JD): Lays the packet out in out as one position-independent block: every reference inside it is
+// an offset from the block's start, so the bytes can be memcpy'd anywhere (another buffer, a shared
+// memory segment, a file) and read in place with the PacketBlock* functions. out must be 8-byte aligned.
+// Returns the block size, or 0 without writing anything if it needs more than capacity bytes.
+u64 PacketWriteBlock(jdat_Packet* packet, void* out, u64 capacity) {
+    u64 size = PacketCalcBlockSize(packet);
+    if (size > capacity) return 0;
+    
+    u64 header_count = 0;
+    u64 element_count = 0;
+    jdat_ForEachHeader(header, packet) {
+        header_count++;
+        element_count += header->num_elements;
+    }
+    
+    u8* base = out;
+    jdat_PacketBlock* block = out;
+    block->magic = PACKET_BLOCK_MAGIC;
+    block->version = PACKET_BLOCK_VERSION;
+    block->size = size;
+    block->header_count = header_count;
+    block->headers_offset = sizeof(jdat_PacketBlock);
+    
+    u64 element_offset = block->headers_offset + sizeof(PacketBlockHeader) * header_count;
+    u64 bytes_offset = element_offset + sizeof(PacketBlockElement) * element_count;
+    PacketBlockHeader* block_header = (PacketBlockHeader*)(base + block->headers_offset);
+    
+    jdat_ForEachHeader(header, packet) {
+        block_header->tag_offset = bytes_offset;
+        block_header->tag_count = header->tag.count;
+        block_header->element_count = header->num_elements;
+        block_header->elements_offset = element_offset;
+        jd_MemCpy(base + bytes_offset, header->tag.mem, header->tag.count);
+        bytes_offset += header->tag.count;
+        
+        PacketBlockElement* block_element = (PacketBlockElement*)(base + element_offset);
+        for (u64 i = 0; i < header->num_elements; i++, block_element++) {
+            PacketElement* element = &header->elements[i];
+            block_element->key_offset = bytes_offset;
+            block_element->key_count = element->key.count;
+            block_element->value_type = element->value_type;
+            block_element->reserved = 0;
+            jd_MemCpy(base + bytes_offset, element->key.mem, element->key.count);
+            bytes_offset += element->key.count;
+            
+            if (element->value_type == PACKET_ELEMENT_VALUE_TYPE_STRING) {
+                block_element->value = bytes_offset;
+                block_element->str_count = element->data.str.count;
+                jd_MemCpy(base + bytes_offset, element->data.str.mem, element->data.str.count);
+                bytes_offset += element->data.str.count;
+            }
+            
+            else {
+                block_element->value = 0;
+                block_element->str_count = 0;
+                jd_MemCpy(&block_element->value, &element->data, packet_type_sizes[element->value_type]);
+            }
+        }
+        
+        element_offset += sizeof(PacketBlockElement) * header->num_elements;
+        block_header++;
+    }
+    
+    jd_Assert(bytes_offset == size);
+    return size;
+}
+
+jdat_PacketBlock* PacketToBlock(jd_Arena* arena, jdat_Packet* packet) {
+    u64 size = PacketCalcBlockSize(packet);
+    void* out = jd_ArenaAlloc(arena, size);
+    PacketWriteBlock(packet, out, size);
+    return out;
+}
+
+// NOTE(JD): For blocks that come from somewhere untrusted (another process's shared memory): checks the
+// prefix and that every offset and count stays inside the size bytes at block. Readers do no checking.
+b32 PacketBlockValidate(void* mem, u64 size) {
+    if (size < sizeof(jdat_PacketBlock)) return false;
+    jdat_PacketBlock* block = mem;
+    if (block->magic != PACKET_BLOCK_MAGIC || block->version != PACKET_BLOCK_VERSION || block->size > size) return false;
+    
+    size = block->size;
+    if (block->headers_offset > size || block->header_count > (size - block->headers_offset) / sizeof(PacketBlockHeader)) return false;
+    
+    for (u64 h = 0; h < block->header_count; h++) {
+        PacketBlockHeader* header = PacketBlockGetHeader(block, h);
+        if (header->tag_offset > size || header->tag_count > size - header->tag_offset) return false;
+        if (header->elements_offset > size || header->element_count > (size - header->elements_offset) / sizeof(PacketBlockElement)) return false;
+        if (header->elements_offset % 8 != 0) return false;
+        
+        for (u64 i = 0; i < header->element_count; i++) {
+            PacketBlockElement* element = PacketBlockGetElement(block, header, i);
+            if (element->value_type == PACKET_ELEMENT_VALUE_TYPE_NULL || element->value_type >= PACKET_ELEMENT_VALUE_TYPE_COUNT) return false;
+            if (element->key_offset > size || element->key_count > size - element->key_offset) return false;
+            if (element->value_type == PACKET_ELEMENT_VALUE_TYPE_STRING) {
+                if (element->value > size || element->str_count > size - element->value) return false;
+            }
+        }
+    }
+    
+    return (block->headers_offset % 8 == 0);
+}
+
+PacketBlockHeader* PacketBlockGetHeader(jdat_PacketBlock* block, u64 index) {
+    if (index >= block->header_count) return NULL;
+    return (PacketBlockHeader*)((u8*)block + block->headers_offset) + index;
+}
+
+jd_String PacketBlockHeaderTag(jdat_PacketBlock* block, PacketBlockHeader* header) {
+    jd_String tag = { .mem = (u8*)block + header->tag_offset, .count = header->tag_count };
+    return tag;
+}
+
+PacketBlockElement* PacketBlockGetElement(jdat_PacketBlock* block, PacketBlockHeader* header, u64 index) {
+    if (index >= header->element_count) return NULL;
+    return (PacketBlockElement*)((u8*)block + header->elements_offset) + index;
+}
+
+// NOTE(JD): Resolves a block element into an ordinary PacketElement whose key and string value point into
+// the block, so the PacketElementGet* functions work on it.
+PacketElement PacketBlockElementResolve(jdat_PacketBlock* block, PacketBlockElement* block_element) {
+    PacketElement element = {0};
+    element.key.mem = (u8*)block + block_element->key_offset;
+    element.key.count = block_element->key_count;
+    element.value_type = (PacketElementValueType)block_element->value_type;
+    
+    if (element.value_type == PACKET_ELEMENT_VALUE_TYPE_STRING) {
+        element.data.str.mem = (u8*)block + block_element->value;
+        element.data.str.count = block_element->str_count;
+    }
+    
+    else {
+        jd_MemCpy(&element.data, &block_element->value, sizeof(block_element->value));
+    }
+    
+    return element;
+}
+
+PacketBlockElement* PacketBlockGetElementWithKey(jdat_PacketBlock* block, PacketBlockHeader* header, jd_String key) {
+    PacketBlockElement* elements = (PacketBlockElement*)((u8*)block + header->elements_offset);
+    for (u64 i = 0; i < header->element_count; i++) {
+        if (elements[i].key_count != key.count) continue;
+        jd_String element_key = { .mem = (u8*)block + elements[i].key_offset, .count = elements[i].key_count };
+        if (jd_StringMatch(element_key, key)) return &elements[i];
+    }
+    
+    return NULL;
+}
+
+PacketBlockHeader* PacketBlockGetFirstHeaderWithTag(jdat_PacketBlock* block, jd_String tag) {
+    for (u64 i = 0; i < block->header_count; i++) {
+        PacketBlockHeader* header = PacketBlockGetHeader(block, i);
+        if (jd_StringMatch(PacketBlockHeaderTag(block, header), tag)) return header;
+    }
+    
+    return NULL;
+}
+
+// NOTE(JD): Builds an ordinary packet over the block. Tags, keys and string values are views into the
+// block, so it has to outlive the packet; only the header and element structs are allocated.
+jdat_Packet* PacketFromBlock(jd_Arena* arena, jdat_PacketBlock* block) {
+    jdat_Packet* packet = PacketCreate(arena);
+    for (u64 h = 0; h < block->header_count; h++) {
+        PacketBlockHeader* block_header = PacketBlockGetHeader(block, h);
+        PacketHeader* header = PacketHeaderPushBackBorrowed(packet, PacketBlockHeaderTag(block, block_header));
+        PacketHeaderReserveElements(header, block_header->element_count);
+        
+        for (u64 i = 0; i < block_header->element_count; i++) {
+            PacketElement element = PacketBlockElementResolve(block, PacketBlockGetElement(block, block_header, i));
+            PacketElementPushBackBorrowed(header, &element);
+        }
+    }
+    
+    return packet;
+}
+
+#if defined(__linux__)
+static void PacketRingFutexWake(volatile u32* addr, int count) {
+    syscall(SYS_futex, addr, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+static u64 PacketRingNowMs(void) {
+    struct timespec now = {0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64)now.tv_sec * 1000 + (u64)now.tv_nsec / 1000000;
+}
+
+// NOTE(JD): Sleeps while *addr still holds expected. Returns false once deadline_ms (from PacketRingNowMs)
+// has passed; a deadline of U64_MAX never passes. Not FUTEX_PRIVATE: the word is shared between processes.
+static b32 PacketRingFutexWait(volatile u32* addr, u32 expected, u64 deadline_ms) {
+    struct timespec timeout = {0};
+    struct timespec* timeout_ptr = NULL;
+    if (deadline_ms != UINT64_MAX) {
+        u64 now = PacketRingNowMs();
+        if (now >= deadline_ms) return false;
+        u64 remaining = deadline_ms - now;
+        timeout.tv_sec = (time_t)(remaining / 1000);
+        timeout.tv_nsec = (long)(remaining % 1000) * 1000000;
+        timeout_ptr = &timeout;
+    }
+    
+    long result = syscall(SYS_futex, addr, FUTEX_WAIT, expected, timeout_ptr, NULL, 0);
+    return !(result != 0 && errno == ETIMEDOUT);
+}
+
+static u64 PacketRingDeadline(u32 timeout_ms) {
+    if (timeout_ms == PACKET_RING_WAIT_FOREVER) return UINT64_MAX;
+    return PacketRingNowMs() + timeout_ms;
+}
+
+// NOTE(JD): The data region is mapped twice, back to back, right after the control page, so every span
+// of up to capacity bytes starting anywhere in the ring is contiguous in memory. That is what lets the
+// producer serialize straight into the ring and the consumer parse straight out of it.
+static jdat_Ring* PacketRingMap(jd_Arena* arena, int fd, u64 data_offset, u64 capacity) {
+    u64 total = data_offset + capacity * 2;
+    u8* base = mmap(NULL, (size_t)total, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return NULL;
+    
+    if (mmap(base, (size_t)(data_offset + capacity), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(base + data_offset + capacity, (size_t)capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, (off_t)data_offset) == MAP_FAILED) {
+        munmap(base, (size_t)total);
+        return NULL;
+    }
+    
+    jdat_Ring* ring = jd_ArenaAlloc(arena, sizeof(*ring));
+    ring->control = (PacketRingControl*)base;
+    ring->data = base + data_offset;
+    ring->capacity = capacity;
+    ring->map_size = total;
+    ring->fd = fd;
+    return ring;
+}
+
+// NOTE(JD): With a name, the ring is a POSIX shared memory object other processes open with
+// PacketRingOpen. Without one it is an anonymous memfd; hand ring->fd to other processes (fork, or a unix
+// socket) and open it there with PacketRingOpenFd. capacity is rounded up to a power of two no smaller
+// than a page.
+jdat_Ring* PacketRingCreate(jd_Arena* arena, jd_String name, u64 capacity, b32 multi_producer) {
+    u64 page = (u64)sysconf(_SC_PAGESIZE);
+    u64 ring_capacity = page;
+    while (ring_capacity < capacity) ring_capacity *= 2;
+    
+    c8* name_z = jd_ArenaAlloc(arena, name.count + 1);
+    if (name.count > 0) jd_MemCpy(name_z, name.mem, name.count);
+    name_z[name.count] = 0;
+    
+    int fd = -1;
+    if (name.count > 0) fd = shm_open(name_z, O_CREAT | O_EXCL | O_RDWR, 0600);
+    else fd = (int)syscall(SYS_memfd_create, "jdat_ring", MFD_CLOEXEC);
+    
+    if (fd < 0 || ftruncate(fd, (off_t)(page + ring_capacity)) != 0) {
+        if (fd >= 0) close(fd);
+        if (fd >= 0 && name.count > 0) shm_unlink(name_z);
+        jd_LogError("Could not create shared memory for jdat ring.", jd_Error_BadInput, jd_Error_Critical);
+        return NULL;
+    }
+    
+    jdat_Ring* ring = PacketRingMap(arena, fd, page, ring_capacity);
+    if (ring == NULL) {
+        close(fd);
+        if (name.count > 0) shm_unlink(name_z);
+        jd_LogError("Could not map jdat ring.", jd_Error_BadInput, jd_Error_Critical);
+        return NULL;
+    }
+    
+    if (name.count > 0) ring->name = name_z;
+    
+    PacketRingControl* control = ring->control;
+    control->capacity = ring_capacity;
+    control->data_offset = page;
+    control->multi_producer = (multi_producer != 0);
+    control->version = PACKET_RING_VERSION;
+    __atomic_store_n(&control->magic, PACKET_RING_MAGIC, __ATOMIC_RELEASE);
+    return ring;
+}
+
+// NOTE(JD): The control page can be written by any process with the fd, so its layout fields are checked
+// against the object's real size before anything is mapped from them.
+jdat_Ring* PacketRingOpenFd(jd_Arena* arena, int fd) {
+    struct stat st = {0};
+    if (fstat(fd, &st) != 0 || (u64)st.st_size < sizeof(PacketRingControl)) {
+        jd_LogError("Shared memory is not a jdat ring.", jd_Error_BadInput, jd_Error_Critical);
+        return NULL;
+    }
+    
+    PacketRingControl* control = mmap(NULL, sizeof(PacketRingControl), PROT_READ, MAP_SHARED, fd, 0);
+    if (control == MAP_FAILED) return NULL;
+    
+    b32 valid = (__atomic_load_n(&control->magic, __ATOMIC_ACQUIRE) == PACKET_RING_MAGIC && control->version == PACKET_RING_VERSION);
+    u64 data_offset = control->data_offset;
+    u64 capacity = control->capacity;
+    munmap(control, sizeof(PacketRingControl));
+    
+    u64 page = (u64)sysconf(_SC_PAGESIZE);
+    u64 size = (u64)st.st_size;
+    valid = valid && capacity >= page && (capacity & (capacity - 1)) == 0;
+    valid = valid && data_offset >= sizeof(PacketRingControl) && data_offset % page == 0;
+    valid = valid && capacity <= size && data_offset <= size - capacity;
+    
+    if (!valid) {
+        jd_LogError("Shared memory is not a jdat ring.", jd_Error_BadInput, jd_Error_Critical);
+        return NULL;
+    }
+    
+    return PacketRingMap(arena, fd, data_offset, capacity);
+}
+
+jdat_Ring* PacketRingOpen(jd_Arena* arena, jd_String name) {
+    c8* name_z = jd_ArenaAlloc(arena, name.count + 1);
+    if (name.count > 0) jd_MemCpy(name_z, name.mem, name.count);
+    name_z[name.count] = 0;
+    
+    int fd = shm_open(name_z, O_RDWR, 0);
+    if (fd < 0) {
+        jd_LogError("Could not open jdat ring.", jd_Error_BadInput, jd_Error_Critical);
+        return NULL;
+    }
+    
+    jdat_Ring* ring = PacketRingOpenFd(arena, fd);
+    if (ring == NULL) close(fd);
+    return ring;
+}
+
+// NOTE(JD): Unmaps the ring. The process that created a named ring also unlinks the name.
+void PacketRingClose(jdat_Ring* ring) {
+    munmap(ring->control, (size_t)ring->map_size);
+    close(ring->fd);
+    if (ring->name != NULL) shm_unlink(ring->name);
+}
+
+// NOTE(JD): Claims count bytes for one producer, waiting for the consumer to free space if needed. With
+// multiple producers the claim is a CAS on reserve_pos, so producers never block each other here.
+static b32 PacketRingReserve(jdat_Ring* ring, u64 count, u32 timeout_ms, u64* out_start) {
+    PacketRingControl* control = ring->control;
+    if (count == 0 || count > ring->capacity) return false;
+    
+    u64 deadline = 0;
+    for (;;) {
+        u64 start = __atomic_load_n(&control->reserve_pos, __ATOMIC_RELAXED);
+        u64 read = __atomic_load_n(&control->read_pos, __ATOMIC_ACQUIRE);
+        if (start + count - read <= ring->capacity) {
+            if (!control->multi_producer) {
+                __atomic_store_n(&control->reserve_pos, start + count, __ATOMIC_RELAXED);
+                *out_start = start;
+                return true;
+            }
+            
+            if (__atomic_compare_exchange_n(&control->reserve_pos, &start, start + count, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                *out_start = start;
+                return true;
+            }
+            
+            continue;
+        }
+        
+        if (timeout_ms == 0) return false;
+        if (deadline == 0) deadline = PacketRingDeadline(timeout_ms);
+        
+        u32 seq = __atomic_load_n(&control->space_seq, __ATOMIC_ACQUIRE);
+        __atomic_add_fetch(&control->producers_waiting, 1, __ATOMIC_SEQ_CST);
+        read = __atomic_load_n(&control->read_pos, __ATOMIC_SEQ_CST);
+        b32 woke = true;
+        if (start + count - read > ring->capacity) woke = PacketRingFutexWait(&control->space_seq, seq, deadline);
+        __atomic_sub_fetch(&control->producers_waiting, 1, __ATOMIC_SEQ_CST);
+        if (!woke) return false;
+    }
+}
+
+// NOTE(JD): Publishes a reservation. Bytes become visible to the consumer in reservation order, so a
+// producer that finished early waits here for the ones that reserved before it.
+static void PacketRingCommit(jdat_Ring* ring, u64 start, u64 count) {
+    PacketRingControl* control = ring->control;
+    if (control->multi_producer) {
+        for (u32 spins = 0; __atomic_load_n(&control->write_pos, __ATOMIC_ACQUIRE) != start; spins++) {
+            if (spins >= 64) sched_yield();
+        }
+    }
+    
+    __atomic_store_n(&control->write_pos, start + count, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&control->data_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&control->consumer_waiting, __ATOMIC_SEQ_CST)) PacketRingFutexWake(&control->data_seq, 1);
+}
+
+// NOTE(JD): bytes must be whole serialized headers (the text form), so any run of committed bytes the
+// consumer sees is itself a valid packet string. Fails without waiting when timeout_ms is 0, and for
+// sends larger than the ring.
+// With multi_producer set, a producer that dies between reserving and committing (inside a send) leaves
+// a reservation nothing will ever commit. Every later commit waits for it forever, and the consumer
+// receives nothing more. There is no recovery from this; the ring has to be recreated.
+b32 PacketRingSend(jdat_Ring* ring, jd_String bytes, u32 timeout_ms) {
+    u64 start = 0;
+    if (!PacketRingReserve(ring, bytes.count, timeout_ms, &start)) return false;
+    jd_MemCpy(&ring->data[start & (ring->capacity - 1)], bytes.mem, bytes.count);
+    PacketRingCommit(ring, start, bytes.count);
+    return true;
+}
+
+// NOTE(JD): Serializes the packet directly into the ring, with no intermediate string.
+b32 PacketRingSendPacket(jdat_Ring* ring, jdat_Packet* packet, u32 timeout_ms) {
+    u64 size = PacketCalcStringLength(packet);
+    if (size == 0) return true;
+    
+    u64 start = 0;
+    if (!PacketRingReserve(ring, size, timeout_ms, &start)) return false;
+    
+    u8* out = &ring->data[start & (ring->capacity - 1)];
+    u64 pos = 0;
+    jdat_ForEachHeader(header, packet) {
+        if (header->num_elements == 0) continue;
+        pos += PacketHeaderWrite(header, &out[pos]);
+    }
+    
+    jd_Assert(pos == size);
+    PacketRingCommit(ring, start, size);
+    return true;
+}
+
+// NOTE(JD): Waits for data and returns everything committed so far as one view into the ring, without
+// copying. The bytes stay valid, and are not overwritten, until PacketRingRelease. Returns an empty
+// string on timeout. There is one consumer per ring.
+jd_String PacketRingReceive(jdat_Ring* ring, u32 timeout_ms) {
+    PacketRingControl* control = ring->control;
+    jd_String batch = {0};
+    u64 read = __atomic_load_n(&control->read_pos, __ATOMIC_RELAXED);
+    
+    u64 deadline = 0;
+    for (;;) {
+        u64 write = __atomic_load_n(&control->write_pos, __ATOMIC_ACQUIRE);
+        if (write != read) {
+            batch.mem = &ring->data[read & (ring->capacity - 1)];
+            batch.count = jd_Min(write - read, ring->capacity); // never past the mirror, whatever the peer wrote
+            ring->received = batch.count;
+            return batch;
+        }
+        
+        if (timeout_ms == 0) return batch;
+        if (deadline == 0) deadline = PacketRingDeadline(timeout_ms);
+        
+        u32 seq = __atomic_load_n(&control->data_seq, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&control->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+        write = __atomic_load_n(&control->write_pos, __ATOMIC_SEQ_CST);
+        b32 woke = true;
+        if (write == read) woke = PacketRingFutexWait(&control->data_seq, seq, deadline);
+        __atomic_store_n(&control->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+        if (!woke) return batch;
+    }
+}
+
+// NOTE(JD): Batch dequeue. Parses everything received in place (PACKET_PARSE_BORROW_STRINGS is forced),
+// so the packet's tags, keys and strings point into the ring: finish with the packet before calling
+// PacketRingRelease. Returns NULL on timeout.
+jdat_Packet* PacketRingDequeue(jd_Arena* arena, jdat_Ring* ring, PacketParseOptions* options, u32 timeout_ms) {
+    jd_String batch = PacketRingReceive(ring, timeout_ms);
+    if (batch.count == 0) return NULL;
+    
+    PacketParseOptions ring_options = {0};
+    if (options != NULL) ring_options = *options;
+    ring_options.flags |= PACKET_PARSE_BORROW_STRINGS;
+    return PacketParseWithOptions(arena, batch, &ring_options);
+}
+
+// NOTE(JD): Hands the bytes of the last receive back to the producers.
+void PacketRingRelease(jdat_Ring* ring) {
+    if (ring->received == 0) return;
+    
+    PacketRingControl* control = ring->control;
+    u64 read = __atomic_load_n(&control->read_pos, __ATOMIC_RELAXED);
+    __atomic_store_n(&control->read_pos, read + ring->received, __ATOMIC_SEQ_CST);
+    ring->received = 0;
+    
+    __atomic_add_fetch(&control->space_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&control->producers_waiting, __ATOMIC_SEQ_CST)) PacketRingFutexWake(&control->space_seq, INT_MAX);
+}
+#endif // __linux__
+
+// NOTE(JD): Compressed streams. Input is compressed in blocks of at most PACKET_COMPRESS_BLOCK_SIZE with
+// LZ4_compress_fast_continue, so every block can reference the 64 KB of input before it, even when it came
+// from an earlier call. Each block is written as a record: raw size and compressed size (u32 each), then
+// the compressed bytes. Both sides keep their history in a ring buffer that outlives the calls.
+static u64 PacketCompressStreamBoundForRecords(u64 count, u64 records) {
+    return count + count / 255 + records * (16 + PACKET_COMPRESS_RECORD_HEADER_SIZE);
+}
+
+u64 PacketCompressStreamBound(u64 count) {
+    return PacketCompressStreamBoundForRecords(count, (count + PACKET_COMPRESS_BLOCK_SIZE - 1) / PACKET_COMPRESS_BLOCK_SIZE);
+}
+
+jdat_CompressStream* PacketCompressStreamCreate(jd_Arena* arena, i32 acceleration) {
+    jdat_CompressStream* stream = jd_ArenaAlloc(arena, sizeof(*stream));
+    stream->lz4 = LZ4_initStream(jd_ArenaAlloc(arena, sizeof(LZ4_stream_t)), sizeof(LZ4_stream_t));
+    stream->ring_size = KILOBYTES(64) + 2 * PACKET_COMPRESS_BLOCK_SIZE;
+    stream->ring = jd_ArenaAlloc(arena, stream->ring_size);
+    stream->acceleration = (acceleration > 0) ? acceleration : 1;
+    return stream;
+}
+
+// NOTE(JD): Where the next block of up to count bytes goes in the ring. The block is written before LZ4
+// sees it, so it must never land on the 64 KB of history before it. With room for the history plus two
+// blocks, a block that wraps to the start always ends before that history begins.
+static u8* PacketCompressRingReserve(jdat_CompressStream* stream, u64 count) {
+    if (stream->ring_pos + count > stream->ring_size) stream->ring_pos = 0;
+    return &stream->ring[stream->ring_pos];
+}
+
+static u64 PacketCompressRingBlock(jdat_CompressStream* stream, u64 count, u8* out) {
+    u8* src = &stream->ring[stream->ring_pos];
+    int compressed = LZ4_compress_fast_continue(stream->lz4, (const char*)src, (char*)out + PACKET_COMPRESS_RECORD_HEADER_SIZE,
+                                                (int)count, LZ4_compressBound((int)count), stream->acceleration);
+    jd_Assert(compressed > 0);
+    
+    u32 sizes[2] = { (u32)count, (u32)compressed };
+    jd_MemCpy(out, sizes, sizeof(sizes));
+    stream->ring_pos += count;
+    return PACKET_COMPRESS_RECORD_HEADER_SIZE + (u64)compressed;
+}
+
+static u64 PacketCompressStreamWriteTo(jdat_CompressStream* stream, jd_String bytes, u8* out) {
+    u64 written = 0;
+    for (u64 offset = 0; offset < bytes.count; offset += PACKET_COMPRESS_BLOCK_SIZE) {
+        u64 count = jd_Min(bytes.count - offset, PACKET_COMPRESS_BLOCK_SIZE);
+        jd_MemCpy(PacketCompressRingReserve(stream, count), &bytes.mem[offset], count);
+        written += PacketCompressRingBlock(stream, count, &out[written]);
+    }
+    
+    return written;
+}
+
+jd_String PacketCompressStreamWrite(jd_Arena* arena, jdat_CompressStream* stream, jd_String bytes) {
+    jd_String out = jd_StringCreateEmpty(arena, PacketCompressStreamBound(bytes.count));
+    out.count = PacketCompressStreamWriteTo(stream, bytes, out.mem);
+    return out;
+}
+
+// NOTE(JD): Serializes the headers straight into the history ring, packing as many as fit into each
+// block. A header bigger than a block is serialized into scratch space at the end of the arena first.
+jd_String PacketCompressStreamWritePacket(jd_Arena* arena, jdat_CompressStream* stream, jdat_Packet* packet) {
+    u64 size = PacketCalcStringLength(packet);
+    u64 header_count = 0;
+    jdat_ForEachHeader(header, packet) header_count++;
+    
+    u64 bound = PacketCompressStreamBoundForRecords(size, header_count + size / PACKET_COMPRESS_BLOCK_SIZE + 1);
+    jd_String out = jd_StringCreateEmpty(arena, bound);
+    u64 written = 0;
+    
+    u8* block = PacketCompressRingReserve(stream, PACKET_COMPRESS_BLOCK_SIZE);
+    u64 filled = 0;
+    jdat_ForEachHeader(header, packet) {
+        if (header->num_elements == 0) continue;
+        
+        if (filled + header->text_size > PACKET_COMPRESS_BLOCK_SIZE && filled > 0) {
+            written += PacketCompressRingBlock(stream, filled, &out.mem[written]);
+            block = PacketCompressRingReserve(stream, PACKET_COMPRESS_BLOCK_SIZE);
+            filled = 0;
+        }
+        
+        if (header->text_size <= PACKET_COMPRESS_BLOCK_SIZE) {
+            filled += PacketHeaderWrite(header, &block[filled]);
+            continue;
+        }
+        
+        u64 scratch_mark = PacketArenaMark(arena);
+        jd_String text = jd_StringCreateEmpty(arena, header->text_size);
+        PacketHeaderWrite(header, text.mem);
+        written += PacketCompressStreamWriteTo(stream, text, &out.mem[written]);
+        PacketArenaRewind(arena, scratch_mark);
+        
+        block = PacketCompressRingReserve(stream, PACKET_COMPRESS_BLOCK_SIZE);
+    }
+    
+    if (filled > 0) written += PacketCompressRingBlock(stream, filled, &out.mem[written]);
+    
+    jd_Assert(written <= bound);
+    out.count = written;
+    return out;
+}
+
+jdat_DecompressStream* PacketDecompressStreamCreate(jd_Arena* arena) {
+    jdat_DecompressStream* stream = jd_ArenaAlloc(arena, sizeof(*stream));
+    stream->lz4 = jd_ArenaAlloc(arena, sizeof(LZ4_streamDecode_t));
+    LZ4_setStreamDecode(stream->lz4, NULL, 0);
+    stream->ring_size = LZ4_DECODER_RING_BUFFER_SIZE(PACKET_COMPRESS_BLOCK_SIZE);
+    stream->ring = jd_ArenaAlloc(arena, stream->ring_size);
+    return stream;
+}
+
+// NOTE(JD): Decodes every complete record in compressed and returns the bytes, ready for PacketParse or
+// PacketParserFeed. A record cut off at the end is left alone; *consumed says where it starts, so the
+// caller can prepend it to the next chunk. Corrupt input sets stream->failed and returns an empty string;
+// the stream cannot be used after that.
+jd_String PacketDecompressStreamRead(jd_Arena* arena, jdat_DecompressStream* stream, jd_String compressed, u64* consumed) {
+    jd_String out = {0};
+    if (consumed != NULL) *consumed = 0;
+    if (stream->failed) return out;
+    
+    // NOTE(JD): Record sizes are checked before anything is allocated from them.
+    u64 total = 0;
+    u64 end = 0;
+    while (compressed.count - end >= PACKET_COMPRESS_RECORD_HEADER_SIZE) {
+        u32 sizes[2] = {0};
+        jd_MemCpy(sizes, &compressed.mem[end], sizeof(sizes));
+        if (sizes[0] > PACKET_COMPRESS_BLOCK_SIZE || sizes[1] > (u32)LZ4_compressBound(PACKET_COMPRESS_BLOCK_SIZE)) {
+            stream->failed = true;
+            break;
+        }
+        
+        if (sizes[1] > compressed.count - end - PACKET_COMPRESS_RECORD_HEADER_SIZE) break;
+        total += sizes[0];
+        end += PACKET_COMPRESS_RECORD_HEADER_SIZE + sizes[1];
+    }
+    
+    if (!stream->failed) out = jd_StringCreateEmpty(arena, total);
+    u64 pos = 0;
+    for (u64 at = 0; at < end && !stream->failed;) {
+        u32 sizes[2] = {0};
+        jd_MemCpy(sizes, &compressed.mem[at], sizeof(sizes));
+        if (stream->ring_size - stream->ring_pos < PACKET_COMPRESS_BLOCK_SIZE) stream->ring_pos = 0;
+        u8* dst = &stream->ring[stream->ring_pos];
+        int decoded = LZ4_decompress_safe_continue(stream->lz4, (const char*)&compressed.mem[at + PACKET_COMPRESS_RECORD_HEADER_SIZE], (char*)dst,
+                                                   (int)sizes[1], PACKET_COMPRESS_BLOCK_SIZE);
+        if (decoded != (int)sizes[0]) {
+            stream->failed = true;
+            break;
+        }
+        
+        jd_MemCpy(&out.mem[pos], dst, sizes[0]);
+        stream->ring_pos += sizes[0];
+        pos += sizes[0];
+        at += PACKET_COMPRESS_RECORD_HEADER_SIZE + sizes[1];
+    }
+    
+    if (stream->failed) {
+        jd_LogError("Corrupt jdat compressed stream.", jd_Error_BadInput, jd_Error_Critical);
+        jd_String empty = {0};
+        return empty;
+    }
+    
+    if (consumed != NULL) *consumed = end;
+    return out;
 }
 
 u64 PacketElementGetU64(PacketElement* packet_element) {
@@ -5,8 +5,8 @@
 #include <jd_lib.h>
 
 #define jdat_ElementByArg(type, val) (PacketElementData){ .type = val }
-#define jdat_ForEachElement(identifier, header) for (u64 identifier = 0; identifier < header->num_elements; identifier++)
-#define jdat_ForEachHeader(identifier, packet) for (PacketHeader* identifier = packet->head; identifier != NULL && identifier != packet->last->next; identifier = identifier->next)
+#define jdat_ForEachElement(identifier, header) for (u64 identifier = (PacketHeaderMaterialize(header), 0); identifier < header->num_elements; identifier++)
+#define jdat_ForEachHeader(identifier, packet) for (PacketHeader* identifier = packet->head; identifier != NULL && identifier != packet->tail->next; identifier = identifier->next)
 
 typedef enum PacketElementValueType {
     PACKET_ELEMENT_VALUE_TYPE_NULL,
@@ -37,61 +37,467 @@ typedef union PacketElementData {
 typedef struct PacketElement {
     jd_String key;
     PacketElementValueType value_type;
+    u32 key_id; // the key's symbol when the header has a symbol table, 0 otherwise
     PacketElementData data;
 } PacketElement;
 
-#define PACKET_HEADER_MAX_ELEMENTS 16
+// NOTE(JD): Interns tags and keys. Each distinct string is stored once, in the table's arena, and gets an
+// id that is stable for the life of the table. Id 0 is never a symbol. Headers and elements of a packet
+// with a table point at the table's copy and carry its id, so lookups compare integers.
+typedef struct PacketSymbol {
+    jd_String str;
+    u32 hash;
+} PacketSymbol;
+
+typedef struct PacketSymbolSlot {
+    u32 hash;
+    u32 id; // 0 is an empty slot
+} PacketSymbolSlot;
+
+typedef struct jdat_SymbolTable {
+    jd_Arena* arena;
+    PacketSymbol* symbols; // by id
+    u64 count;
+    u64 symbol_capacity;
+    PacketSymbolSlot* slots;
+    u64 slot_capacity;
+} jdat_SymbolTable;
+
+// NOTE(JD): Elements are stored by value in one contiguous array, so walking a header is a linear read.
+// The first PACKET_HEADER_INLINE_ELEMENTS live in the header itself. Past that, elements points at an arena
+// array that doubles as it fills, so there is no cap on element count. Growing moves the elements:
+// a PacketElement* from a header is only valid until the next push onto that header.
+#define PACKET_HEADER_INLINE_ELEMENTS 8
+
+// NOTE(JD): Headers with at least this many elements answer key lookups through a hash index, built when the
+// header reaches this size and kept up to date on every push. Smaller headers are just scanned. Lookups
+// only read the header, except on a lazy header, which decodes its elements on first access.
+#define PACKET_HEADER_KEY_INDEX_MIN_ELEMENTS 16
+
+// NOTE(JD): Slots hold a 32-bit element index to keep them at 8 bytes. A header with more elements than
+// that (over 160 GB of PacketElements) drops its index and is scanned instead. Defining a lower limit
+// before including jdat.h lets tests reach the fallback with a small header.
+#ifndef PACKET_HEADER_KEY_INDEX_MAX_ELEMENTS
+#define PACKET_HEADER_KEY_INDEX_MAX_ELEMENTS 0xFFFFFFFEull
+#endif
+
+typedef struct PacketKeySlot {
+    u32 hash;
+    u32 element; // index + 1, 0 is an empty slot
+} PacketKeySlot;
+
+_Static_assert(PACKET_HEADER_KEY_INDEX_MAX_ELEMENTS + 1 <= (u32)~0u, "PacketKeySlot.element must hold every indexed element's index + 1");
 
 typedef struct PacketHeader {
     jd_String tag;
     u64 num_elements;
-    PacketElement* elements[PACKET_HEADER_MAX_ELEMENTS];
+    u64 element_capacity;
+    PacketElement* elements;
+    PacketElement inline_elements[PACKET_HEADER_INLINE_ELEMENTS];
+    PacketKeySlot* key_index;
+    u64 key_index_capacity;
     u64 text_size;
     jd_Arena* arena;
     struct PacketHeader* next;
     struct PacketHeader* last;
+    struct PacketHeader* next_with_tag;
+    struct PacketHeader* last_with_tag;
+    b32 tag_indexed;
+    b32 lazy;              // elements not decoded yet, see PacketHeaderMaterialize
+    jd_String lazy_source; // the header's text after '{', up to and including '}'
+    b32 cache_text;        // keep a copy of the serialized text, see PacketEnableTextCache
+    jd_String cached_text; // mem is NULL when there is no valid copy
+    jdat_SymbolTable* symbols;
+    u32 tag_id;
 } PacketHeader;
 
+typedef struct PacketTagSlot {
+    jd_String tag; // mem is NULL for an empty slot
+    u32 hash;
+    PacketHeader* first;
+    PacketHeader* last;
+} PacketTagSlot;
+
+// NOTE(JD): Also the number of threads that can hold a per-thread free list in a jdat_PacketPool at once.
+// A thread's slot is given back when it exits, and its free lists go to the next thread to take the slot.
+// Threads beyond this many live at once bypass the free lists (see PacketPoolStats.uncached_calls).
+#define PACKET_MAX_THREADS 64
+#define PACKET_PARALLEL_MIN_BYTES MEGABYTES(1) // below this, the parallel paths just run on the calling thread
+
 typedef enum PacketErrorCode {
     PACKET_INCOMPLETE_ELEMENT,
     PACKET_INCOMPLETE_HEADER,
     PACKET_UNKNOWN_TYPE,
+    PACKET_UNSUPPORTED_VERSION,
+    PACKET_OUT_OF_MEMORY,
 } PacketErrorCode;
 
 typedef struct PacketError {
     b32 success;
     PacketErrorCode code;
     c8 missing_char;
-    u32 error_index;
+    u64 error_index;
 } PacketError;
 
+// NOTE(JD): Compact binary framing, written by PacketToBinary and detected by PacketParse. It starts with
+// the bytes 0x89 'J' 'D' 'B' and a version byte, followed by one record per non-empty header:
+//     varint tag length, tag, varint element count, then per element:
+//     type byte (PacketElementValueType), varint key length, key,
+//     value: varint length + bytes for strings, otherwise the value's bytes as in the text form.
+// Varints are LEB128. There is no whitespace or punctuation.
+#define PACKET_BINARY_VERSION 1
+#define PACKET_BINARY_PREFIX_SIZE 5
+
+typedef enum PacketParseFlags {
+    PACKET_PARSE_FLAGS_NONE      = 0,
+    PACKET_PARSE_BORROW_STRINGS  = 1 << 0, // tags, keys and string values are views into packet_string
+    PACKET_PARSE_BUILD_KEY_INDEX = 1 << 1, // no effect: key indices are always built as wide headers fill
+    PACKET_PARSE_LAZY            = 1 << 2, // only find headers; decode each one's elements on first access (implies borrowing).
+                                           // Reading a lazy header from several threads needs PacketHeaderMaterialize first.
+} PacketParseFlags;
+
+// NOTE(JD): When a parse is given tag filters, only headers whose tag is listed are built. Everything
+// else is walked past by payload length with nothing allocated. A filter with keys also drops every
+// element whose key is not listed (eager parses only; a lazy header decodes all of its elements).
+typedef struct PacketTagFilter {
+    jd_String tag;
+    jd_String* keys;
+    u64 key_count;
+} PacketTagFilter;
+
+typedef struct PacketParseOptions {
+    PacketParseFlags flags;
+    PacketTagFilter* tag_filters;
+    u64 tag_filter_count;
+    jdat_SymbolTable* symbols; // intern tags and keys here, see PacketSetSymbolTable
+} PacketParseOptions;
+
+// NOTE(JD): Callbacks for PacketVisit. Any of them may be NULL. The element passed to on_element, and
+// the strings in it, are only valid for the duration of the call unless packet_string outlives them.
+typedef struct jdat_Visitor {
+    void* user;
+    void (*on_header_begin)(void* user, jd_String tag);
+    void (*on_element)(void* user, PacketElement* element);
+    void (*on_header_end)(void* user);
+} jdat_Visitor;
+
+// NOTE(JD): Where the parser is in the grammar. Indices are relative to the buffer being parsed;
+// base_offset is how many bytes of the stream came before that buffer.
+typedef struct PacketParseState {
+    c8  required_char;
+    u64 index;
+    u64 str_in_progress_index;
+    u64 key_index;
+    u64 key_count;
+    u64 base_offset;
+    PacketHeader* header; // the header between its '{' and '}', NULL otherwise
+    b32 skim;             // walk the grammar without building anything
+    u64 stop_index;       // when skimming, stop at the first header starting at or after this
+    u64 header_count;     // headers and elements walked while skimming
+    u64 element_count;
+    b32 lazy;             // push headers but leave their elements for PacketHeaderMaterialize
+    PacketTagFilter* tag_filters;
+    u64 tag_filter_count;
+    PacketTagFilter* tag_filter; // the current header's filter, if any
+    jdat_Visitor* visitor;       // report headers and elements here instead of building them
+    b32 visiting_header;
+} PacketParseState;
+
 typedef struct jdat_Packet {
     PacketError error;
     PacketHeader* head;
     PacketHeader* tail;
     jd_Arena* arena;
+    PacketTagSlot* tag_index;
+    u64 tag_index_capacity;
+    u64 tag_count;
+    jd_Arena** worker_arenas; // set by PacketParseParallel
+    u32 worker_arena_count;
+    jd_String file_view; // set by PacketOpenFile
+    struct PacketPoolEntry* pool_entry; // set by PacketPoolAcquire and PacketPoolParse
+    b32 cache_text;
+    jdat_SymbolTable* symbols;
 } jdat_Packet;
 
+// NOTE(JD): A packet laid out as one contiguous, position-independent block (see PacketWriteBlock). All
+// references are byte offsets from the start of the block, so a block can be copied with one memcpy or
+// mapped into another process and read where it lands.
+#define PACKET_BLOCK_MAGIC 0x42504a44u // "DJPB" little-endian
+#define PACKET_BLOCK_VERSION 1
+
+typedef struct jdat_PacketBlock {
+    u32 magic;
+    u32 version;
+    u64 size;
+    u64 header_count;
+    u64 headers_offset; // PacketBlockHeader[header_count]
+} jdat_PacketBlock;
+
+typedef struct PacketBlockHeader {
+    u64 tag_offset;
+    u64 tag_count;
+    u64 element_count;
+    u64 elements_offset; // PacketBlockElement[element_count]
+} PacketBlockHeader;
+
+typedef struct PacketBlockElement {
+    u64 key_offset;
+    u64 key_count;
+    u32 value_type;
+    u32 reserved;
+    u64 value;     // the value's bytes, or for strings the offset of the string
+    u64 str_count;
+} PacketBlockElement;
+
+// NOTE(JD): Recycles packet arenas for code that parses or builds one short-lived packet per message.
+// Released packets have their arena reset, not freed, so a warm arena's pages are reused instead of being
+// mapped and faulted in again. Free arenas are kept per thread, so the hot path takes no locks.
+#define PACKET_POOL_ARENA_CAPACITY GIGABYTES(1)
+#define PACKET_POOL_MAX_FREE_PER_THREAD 64
+
+typedef struct PacketPoolEntry {
+    jd_Arena* arena;
+    struct PacketPoolEntry* next;
+    u64 base_pos;   // arena position just past this entry
+    u64 high_water; // the most this arena has held
+} PacketPoolEntry;
+
+typedef struct PacketPoolCache {
+    PacketPoolEntry* free;
+    u64 free_count;
+    u64 arenas_created;
+    u64 arenas_released;
+    u64 acquires;
+    u64 releases;
+    u64 high_water_bytes;
+    i64 total_high_water_bytes;
+    u8 pad[64]; // keep threads' caches off each other's cache lines
+} PacketPoolCache;
+
+typedef struct jdat_PacketPool {
+    u64 arena_capacity;
+    u64 max_free_per_thread;
+    volatile u32 uncached_calls;
+    PacketPoolCache caches[PACKET_MAX_THREADS];
+} jdat_PacketPool;
+
+typedef struct PacketPoolStats {
+    u64 arenas_created;
+    u64 arenas_released;
+    u64 acquires;
+    u64 releases;
+    u64 free_arenas;
+    u64 high_water_bytes;       // the most any one packet's arena has held
+    u64 total_high_water_bytes; // sum of every live arena's high water
+    u64 uncached_calls;         // calls from threads that found every slot taken (wraps at 2^32)
+} PacketPoolStats;
+
+// NOTE(JD): Shared-memory ring carrying serialized headers between processes (Linux only). One consumer
+// per ring; one producer, or several with multi_producer set. Producers serialize straight into the ring
+// and the consumer parses straight out of it, and both sides sleep on futexes in the control page when
+// the ring is empty or full. Positions only ever grow; they are reduced modulo capacity to index data.
+#define PACKET_RING_MAGIC 0x474e524au // "JRNG" little-endian
+#define PACKET_RING_VERSION 1
+#define PACKET_RING_WAIT_FOREVER 0xffffffffu
+
+typedef struct PacketRingControl {
+    u32 magic;
+    u32 version;
+    u64 capacity;
+    u64 data_offset;
+    u32 multi_producer;
+    u8 pad0[36];
+    
+    // NOTE(JD): Producer side.
+    volatile u64 reserve_pos;
+    volatile u64 write_pos;
+    volatile u32 data_seq;         // bumped on every commit, the consumer's futex word
+    volatile u32 consumer_waiting;
+    u8 pad1[40];
+    
+    // NOTE(JD): Consumer side.
+    volatile u64 read_pos;
+    volatile u32 space_seq;        // bumped on every release, the producers' futex word
+    volatile u32 producers_waiting;
+    u8 pad2[48];
+} PacketRingControl;
+
+typedef struct jdat_Ring {
+    PacketRingControl* control;
+    u8* data;
+    u64 capacity;
+    u64 map_size;
+    int fd;
+    c8* name;     // set for a named ring this process created, which is unlinked on close
+    u64 received; // bytes handed out by the last receive, given back by PacketRingRelease
+} jdat_Ring;
+
+// NOTE(JD): Streaming parser. Feed it chunks of text-format input of any size as they arrive; completed
+// headers are appended to parser->packet and handed out in order by PacketParserNextHeader. Binary-framed
+// input (PacketToBinary) is not recognized here and fails to parse as text. Only the bytes of the token in
+// progress are kept between feeds. Tags, keys and strings are always copied, unless PacketSetSymbolTable
+// has been called on parser->packet, in which case tags and keys go to the table.
+// Headers live in an arena the parser owns. Call PacketParserDiscardEmitted after handling the headers
+// PacketParserNextHeader returned to keep a long-lived stream from growing, and PacketParserRelease
+// when done with the parser.
+#define PACKET_PARSER_ARENA_CAPACITY GIGABYTES(1)
+
+typedef struct jdat_Parser {
+    jd_Arena* arena;   // the parsed headers, rewound once everything parsed has been handed out and discarded
+    u64 arena_base;
+    jd_Arena* scratch; // the pending bytes, rewound whenever nothing is pending
+    u64 scratch_base;
+    u64 pending_mark;  // where pending was allocated in scratch
+    jdat_Packet* packet;
+    PacketParseState state;
+    PacketHeader* last_emitted;
+    u8* pending;
+    u64 pending_count;
+    u64 pending_capacity;
+} jdat_Parser;
+
+// NOTE(JD): Streaming writer. Emits the same bytes PacketToString would for the same headers and elements,
+// without building a packet. Output goes into a block that is passed to flush whenever it fills (a file
+// descriptor, a ring, a socket), or, for PacketWriterCreateBuffer, straight into the caller's buffer.
+// Every call returns false once a flush has failed or the buffer is full.
+#define PACKET_WRITER_BLOCK_SIZE MEGABYTES(1)
+
+typedef b32 (*PacketWriterFlushFunc)(void* user, u8* data, u64 count);
+
+typedef struct jdat_Writer {
+    u8* buf;
+    u64 count;    // bytes in buf not yet flushed
+    u64 capacity;
+    u64 flushed;  // bytes handed to flush so far
+    PacketWriterFlushFunc flush;
+    void* user;
+    jd_String tag;
+    b32 in_header;
+    b32 header_open;
+    b32 failed;
+} jdat_Writer;
+
+// NOTE(JD): Scatter-gather output. Laid out like POSIX struct iovec, so vecs can be passed to writev or
+// pwritev as they are.
+#define PACKET_IOVEC_MIN_REFERENCE_SIZE KILOBYTES(4)
+
+typedef struct PacketIoVec {
+    void* base;
+    u64 len;
+} PacketIoVec;
+
+typedef struct PacketIoVecList {
+    PacketIoVec* vecs;
+    u64 count;
+    u64 total_size;
+} PacketIoVecList;
+
+jdat_SymbolTable* PacketSymbolTableCreate(jd_Arena* arena);
+u32 PacketSymbolIntern(jdat_SymbolTable* table, jd_String str);
+u32 PacketSymbolFind(jdat_SymbolTable* table, jd_String str);
+jd_String PacketSymbolString(jdat_SymbolTable* table, u32 id);
+void PacketSetSymbolTable(jdat_Packet* packet, jdat_SymbolTable* table);
+
 jdat_Packet* PacketCreate(jd_Arena* arena);
 PacketHeader* PacketHeaderPushBack(jdat_Packet* packet, jd_String tag);
+PacketHeader* PacketHeaderPushBackBorrowed(jdat_Packet* packet, jd_String tag);
 PacketElement* PacketElementPushBack(PacketHeader* header, PacketElement* in_element);
+PacketElement* PacketElementPushBackBorrowed(PacketHeader* header, PacketElement* in_element);
+// NOTE(JD): Reserves the next slot in the header, fills it from in_element with the key and string value used
+// as given, and returns the slot. The pointer stays valid until the next push on that header.
 PacketElement* PacketElementPushBackInPlace(PacketHeader* header, PacketElement* in_element);
 PacketElement* PacketElementPushBackByArg(PacketHeader* header, jd_String key, PacketElementValueType type, PacketElementData data);
 
 PacketElement* PacketElementPushBackString(PacketHeader* header, jd_String key, jd_String val);
 PacketElement* PacketElementPushBackU64(PacketHeader* header, jd_String key, u64 val);
 PacketElement* PacketElementPushBackU32(PacketHeader* header, jd_String key, u32 val);
+PacketElement* PacketElementSetByArg(PacketHeader* header, PacketElement* element, PacketElementValueType type, PacketElementData data);
+
+void PacketEnableTextCache(jdat_Packet* packet);
+void PacketHeaderInvalidateText(PacketHeader* header);
 
-void PacketSetError(jdat_Packet* packet, PacketErrorCode code, c8 missing_char, u32 error_index);
+void PacketSetError(jdat_Packet* packet, PacketErrorCode code, c8 missing_char, u64 error_index);
 jdat_Packet* PacketParse(jd_Arena* arena, jd_String packet_string);
+jdat_Packet* PacketParseWithOptions(jd_Arena* arena, jd_String packet_string, PacketParseOptions* options);
+jdat_Packet* PacketParseParallel(jd_Arena* arena, jd_String packet_string, PacketParseOptions* options, u32 thread_count);
+void PacketReleaseWorkerArenas(jdat_Packet* packet);
+b32 PacketHeaderMaterialize(PacketHeader* header);
+PacketError PacketVisit(jd_String packet_string, jdat_Visitor* visitor);
+
+jdat_PacketPool* PacketPoolCreate(jd_Arena* arena, u64 arena_capacity, u32 warm_count);
+void PacketPoolDestroy(jdat_PacketPool* pool);
+jdat_Packet* PacketPoolAcquire(jdat_PacketPool* pool);
+jdat_Packet* PacketPoolParse(jdat_PacketPool* pool, jd_String packet_string, PacketParseOptions* options);
+void PacketPoolRelease(jdat_PacketPool* pool, jdat_Packet* packet);
+PacketPoolStats PacketPoolGetStats(jdat_PacketPool* pool);
+
+#if defined(__linux__)
+jdat_Ring*   PacketRingCreate(jd_Arena* arena, jd_String name, u64 capacity, b32 multi_producer);
+jdat_Ring*   PacketRingOpen(jd_Arena* arena, jd_String name);
+jdat_Ring*   PacketRingOpenFd(jd_Arena* arena, int fd);
+void         PacketRingClose(jdat_Ring* ring);
+b32          PacketRingSend(jdat_Ring* ring, jd_String bytes, u32 timeout_ms);
+b32          PacketRingSendPacket(jdat_Ring* ring, jdat_Packet* packet, u32 timeout_ms);
+jd_String    PacketRingReceive(jdat_Ring* ring, u32 timeout_ms);
+jdat_Packet* PacketRingDequeue(jd_Arena* arena, jdat_Ring* ring, PacketParseOptions* options, u32 timeout_ms);
+void         PacketRingRelease(jdat_Ring* ring);
+#endif
+
+jdat_Packet* PacketOpenFile(jd_Arena* arena, jd_String path, PacketParseOptions* options);
+void PacketCloseFile(jdat_Packet* packet);
+
+jdat_Parser*  PacketParserCreate(jd_Arena* arena);
+b32           PacketParserFeed(jdat_Parser* parser, jd_String chunk);
+b32           PacketParserFinish(jdat_Parser* parser);
+PacketHeader* PacketParserNextHeader(jdat_Parser* parser);
+void          PacketParserDiscardEmitted(jdat_Parser* parser);
+void          PacketParserReset(jdat_Parser* parser);
+void          PacketParserRelease(jdat_Parser* parser);
+
+jdat_Writer* PacketWriterCreate(jd_Arena* arena, u64 block_size, PacketWriterFlushFunc flush, void* user);
+jdat_Writer* PacketWriterCreateBuffer(jd_Arena* arena, u8* buf, u64 capacity);
+jdat_Writer* PacketWriterCreateFile(jd_Arena* arena, int fd);
+b32 PacketWriterBeginHeader(jdat_Writer* writer, jd_String tag);
+b32 PacketWriterEndHeader(jdat_Writer* writer);
+b32 PacketWriterPutElement(jdat_Writer* writer, PacketElement* element);
+b32 PacketWriterPutByArg(jdat_Writer* writer, jd_String key, PacketElementValueType type, PacketElementData data);
+b32 PacketWriterPutString(jdat_Writer* writer, jd_String key, jd_String val);
+b32 PacketWriterPutU64(jdat_Writer* writer, jd_String key, u64 val);
+b32 PacketWriterPutU32(jdat_Writer* writer, jd_String key, u32 val);
+b32 PacketWriterFlush(jdat_Writer* writer);
+
 jd_String PacketToString(jd_Arena* arena, jdat_Packet* packet, jd_ArenaStr* arena_str);
+jd_String PacketToStringParallel(jd_Arena* arena, jdat_Packet* packet, u32 thread_count);
+PacketIoVecList PacketToIoVec(jd_Arena* arena, jdat_Packet* packet, u64 min_reference_size);
+b32 PacketWriteIoVec(int fd, PacketIoVecList* list);
 u64 PacketCalcStringLength(jdat_Packet* packet);
+jd_String PacketToBinary(jd_Arena* arena, jdat_Packet* packet);
+u64 PacketCalcBinaryLength(jdat_Packet* packet);
+b32 PacketIsBinary(jd_String packet_string);
+jd_String PacketTextToBinary(jd_Arena* arena, jd_String text);
+jd_String PacketBinaryToText(jd_Arena* arena, jd_String binary);
 PacketHeader* PacketGetFirstHeaderWithTag(jdat_Packet* packet, jd_String tag);
 PacketHeader* PacketGetNextHeaderWithTag(PacketHeader* starting_header, jd_String tag);
 PacketElement* PacketGetElementWithKey(PacketHeader* header, jd_String key);
+PacketElement* PacketGetElementWithKeyHash(PacketHeader* header, jd_String key, u32 hash);
+PacketElement* PacketGetElementWithKeyId(PacketHeader* header, u32 key_id);
+u32 PacketKeyHash(jd_String key);
+void PacketHeaderBuildKeyIndex(PacketHeader* header);
 void PacketJoinToBack(jdat_Packet* to_packet, jdat_Packet* from_packet);
 b32 PacketCopyToBack(jd_Arena* arena, jdat_Packet* to_packet, jdat_Packet* from_packet);
 PacketHeader* PacketHeaderCopy(jd_Arena* arena, PacketHeader* src);
+
+u64 PacketCalcBlockSize(jdat_Packet* packet);
+u64 PacketWriteBlock(jdat_Packet* packet, void* out, u64 capacity);
+jdat_PacketBlock* PacketToBlock(jd_Arena* arena, jdat_Packet* packet);
+b32 PacketBlockValidate(void* mem, u64 size);
+PacketBlockHeader* PacketBlockGetHeader(jdat_PacketBlock* block, u64 index);
+jd_String PacketBlockHeaderTag(jdat_PacketBlock* block, PacketBlockHeader* header);
+PacketBlockElement* PacketBlockGetElement(jdat_PacketBlock* block, PacketBlockHeader* header, u64 index);
+PacketElement PacketBlockElementResolve(jdat_PacketBlock* block, PacketBlockElement* block_element);
+PacketBlockElement* PacketBlockGetElementWithKey(jdat_PacketBlock* block, PacketBlockHeader* header, jd_String key);
+PacketBlockHeader* PacketBlockGetFirstHeaderWithTag(jdat_PacketBlock* block, jd_String tag);
+jdat_Packet* PacketFromBlock(jd_Arena* arena, jdat_PacketBlock* block);
 b32 PacketHeaderAppendToArenaStr(PacketHeader* header, jd_ArenaStr* arena_str, b32 limit_value_string_len, u64 max_value_string_len);
 void PacketHeaderPop(jdat_Packet* packet, PacketHeader* header);
 
@@ -110,6 +516,35 @@ typedef struct jd_StringCompressed {
     u64 decompressed_size;
 } jd_StringCompressed;
 
+// NOTE(JD): Compressed packet streams. Unlike StringCompress, each call continues the same LZ4 stream, so
+// a run of small, similar headers compresses against the last 64 KB of everything sent before it. The
+// decompressing side must see every record, in order, from the start of the stream.
+#define PACKET_COMPRESS_BLOCK_SIZE KILOBYTES(64)
+#define PACKET_COMPRESS_RECORD_HEADER_SIZE 8
+
+typedef struct jdat_CompressStream {
+    union LZ4_stream_u* lz4;
+    u8* ring; // input history
+    u64 ring_size;
+    u64 ring_pos;
+    i32 acceleration;
+} jdat_CompressStream;
+
+typedef struct jdat_DecompressStream {
+    union LZ4_streamDecode_u* lz4;
+    u8* ring; // output history
+    u64 ring_size;
+    u64 ring_pos;
+    b32 failed;
+} jdat_DecompressStream;
+
+jdat_CompressStream*   PacketCompressStreamCreate(jd_Arena* arena, i32 acceleration);
+jd_String              PacketCompressStreamWrite(jd_Arena* arena, jdat_CompressStream* stream, jd_String bytes);
+jd_String              PacketCompressStreamWritePacket(jd_Arena* arena, jdat_CompressStream* stream, jdat_Packet* packet);
+u64                    PacketCompressStreamBound(u64 count);
+jdat_DecompressStream* PacketDecompressStreamCreate(jd_Arena* arena);
+jd_String              PacketDecompressStreamRead(jd_Arena* arena, jdat_DecompressStream* stream, jd_String compressed, u64* consumed);
+
 jd_StringCompressed StringCompress(jd_Arena* arena, jd_String src);
 jd_String StringDecompress(jd_Arena* arena, jd_StringCompressed src);
 u64 StringCalcCompressedLength(u64 count);
@@ -0,0 +1,66 @@
+// NOTE(JD): Checks that key lookups stay correct once a header grows past PACKET_HEADER_KEY_INDEX_MAX_ELEMENTS.
+// The real limit needs over 160 GB of elements, so this build lowers it to reach the linear-scan fallback.
+// Build from the repo root with jd_lib on the include path:
+//     cc -std=gnu17 -I. -I<jd_lib> tests/key_index_cap.c -o key_index_cap -lpthread && ./key_index_cap
+#define PACKET_HEADER_KEY_INDEX_MAX_ELEMENTS 64ull
+
+#include <stdio.h>
+#include "jdat.h"
+#include "jdat.c"
+
+#define KEY_INDEX_CAP_TEST_ELEMENTS (PACKET_HEADER_KEY_INDEX_MAX_ELEMENTS + 36)
+
+static int failures = 0;
+
+static void Check(b32 condition, const char* what, u64 at) {
+    if (condition) return;
+    printf("key_index_cap: %s (element %llu)\n", what, (unsigned long long)at);
+    failures++;
+}
+
+static jd_String KeyForIndex(jd_Arena* arena, u64 i) {
+    char buf[32] = {0};
+    int count = snprintf(buf, sizeof(buf), "key_%llu", (unsigned long long)i);
+    jd_String key = { .mem = (u8*)buf, .count = (u64)count };
+    return jd_StringPush(arena, key);
+}
+
+static void CheckLookups(PacketHeader* header, jd_Arena* arena, u64 count) {
+    for (u64 i = 0; i < count; i++) {
+        jd_String key = KeyForIndex(arena, i);
+        PacketElement* element = PacketGetElementWithKey(header, key);
+        Check(element == &header->elements[i], "PacketGetElementWithKey missed a key", i);
+        Check(PacketGetElementWithKeyHash(header, key, PacketKeyHash(key)) == element, "PacketGetElementWithKeyHash disagrees", i);
+        Check(PacketElementGetU64(element) == i, "wrong value for key", i);
+    }
+    
+    Check(PacketGetElementWithKey(header, jd_StrLit("key_missing")) == NULL, "found a key that was never pushed", count);
+}
+
+static void TestHeader(jd_Arena* arena, b32 with_symbols) {
+    jdat_Packet* packet = PacketCreate(arena);
+    if (with_symbols) PacketSetSymbolTable(packet, PacketSymbolTableCreate(arena));
+    PacketHeader* header = PacketHeaderPushBack(packet, jd_StrLit("cap"));
+    
+    for (u64 i = 0; i < KEY_INDEX_CAP_TEST_ELEMENTS; i++) {
+        PacketElementPushBackU64(header, KeyForIndex(arena, i), i);
+        if (i + 1 == PACKET_HEADER_KEY_INDEX_MAX_ELEMENTS) {
+            Check(header->key_index != NULL, "header at the cap has no key index", i);
+            CheckLookups(header, arena, i + 1);
+        }
+    }
+    
+    Check(header->key_index == NULL, "header past the cap kept its key index", KEY_INDEX_CAP_TEST_ELEMENTS);
+    CheckLookups(header, arena, KEY_INDEX_CAP_TEST_ELEMENTS);
+}
+
+int main(void) {
+    jd_Arena* arena = jd_ArenaCreate(MEGABYTES(16), 0);
+    TestHeader(arena, false);
+    TestHeader(arena, true);
+    jd_ArenaRelease(arena);
+    
+    if (failures > 0) return 1;
+    printf("key_index_cap: ok\n");
+    return 0;
+}